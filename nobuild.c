@@ -1,3 +1,5 @@
+// wait4() for the peak RSS of the benchmarked processes
+#define _DEFAULT_SOURCE
 #define NOBUILD_IMPLEMENTATION
 #include "./nobuild.h"
 
@@ -13,17 +15,1022 @@ const char *cc(void)
     return result ? result : "cc";
 }
 
+#ifndef _WIN32
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+
+#define BENCH_DIR "bench"
+#define BENCH_RUNS 5
+// The benchmarks time an optimized build, the timings of the debug
+// ./minicel say little about the speed of the parser or the evaluator
+#define BENCH_MINICEL "./minicel-bench"
+#define BENCH_CFLAGS CFLAGS, "-O2"
+// Follows the sources of ./minicel: shm_open() of the snapshots is only
+// in librt before glibc 2.34
+#ifdef __linux__
+#define MINICEL_LIBS , "-lrt"
+#else
+#define MINICEL_LIBS
+#endif
+
+static const char *bench_scenarios[] = {
+    "chain", "wide", "clone", "fill", "fanin", "text", "numeric",
+};
+
+// The scenarios that are mostly formulas, for `./nobuild parsebench`
+static const char *parsebench_scenarios[] = {
+    "chain", "wide", "clone", "fanin",
+};
+
+static const char *bench_default_sizes[] = {
+    "1000", "100000", "1000000",
+};
+
+#define ARRAY_LEN(xs) (sizeof(xs) / sizeof((xs)[0]))
+
+double bench_now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+double median_of(const double *xs, size_t count)
+{
+    double *sorted = malloc(sizeof(*sorted) * count);
+    memcpy(sorted, xs, sizeof(*sorted) * count);
+    qsort(sorted, count, sizeof(*sorted), compare_doubles);
+    double median = count % 2 == 1
+        ? sorted[count / 2]
+        : (sorted[count / 2 - 1] + sorted[count / 2]) / 2.0;
+    free(sorted);
+    return median;
+}
+
+// Builds the generator and the optimized ./minicel the benchmarks run
+void bench_build(void)
+{
+    CMD(cc(), BENCH_CFLAGS, "-o", "gen", "src/gen.c");
+    CMD(cc(), BENCH_CFLAGS, "-o", BENCH_MINICEL, "src/main.c" MINICEL_LIBS);
+    MKDIRS(BENCH_DIR);
+}
+
+// Makes sure the sheet of the scenario exists and returns its path
+Cstr bench_sheet(Cstr scenario, Cstr size)
+{
+    Cstr sheet_path = PATH(BENCH_DIR, CONCAT(scenario, "-", size, ".csv"));
+    if (!PATH_EXISTS(sheet_path)) {
+        CMD("./gen", scenario, size, sheet_path);
+    }
+    return sheet_path;
+}
+
+// Runs `<minicel> [flag] <sheet_path>` with the output discarded. The
+// `flag` is optional. Returns the wall time and the peak RSS of the
+// process in KiB.
+double bench_run(Cstr minicel, Cstr flag, Cstr sheet_path, long *peak_rss_kib)
+{
+    double begin = bench_now_secs();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        PANIC("could not fork: %s", strerror(errno));
+    }
+
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+            PANIC("could not redirect the output to /dev/null: %s", strerror(errno));
+        }
+        if (flag != NULL) {
+            execl(minicel, minicel, flag, sheet_path, (char *) NULL);
+        } else {
+            execl(minicel, minicel, sheet_path, (char *) NULL);
+        }
+        PANIC("could not exec %s: %s", minicel, strerror(errno));
+    }
+
+    int wstatus = 0;
+    struct rusage usage;
+    if (wait4(pid, &wstatus, 0, &usage) < 0) {
+        PANIC("could not wait on %s: %s", minicel, strerror(errno));
+    }
+    double secs = bench_now_secs() - begin;
+
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        PANIC("%s %s has failed", minicel, sheet_path);
+    }
+
+    *peak_rss_kib = usage.ru_maxrss;
+    return secs;
+}
+
+// Generates the sheets that are not generated yet and runs BENCH_MINICEL on
+// every one of them BENCH_RUNS times. `sizes` are amounts of cells, the
+// defaults are used when there are none.
+void bench(int sizes_count, char **sizes)
+{
+    if (sizes_count == 0) {
+        sizes_count = ARRAY_LEN(bench_default_sizes);
+        sizes = (char **) bench_default_sizes;
+    }
+
+    bench_build();
+
+    printf("%-8s %10s %10s %10s %12s %10s %14s %10s %12s\n",
+           "scenario", "cells", "size MB", "median ms", "var ms^2", "spread %", "cells/s", "MB/s", "peak KiB");
+    for (size_t i = 0; i < ARRAY_LEN(bench_scenarios); ++i) {
+        for (int j = 0; j < sizes_count; ++j) {
+            const char *scenario = bench_scenarios[i];
+            const char *size = sizes[j];
+            Cstr sheet_path = bench_sheet(scenario, size);
+
+            struct stat statbuf;
+            if (stat(sheet_path, &statbuf) < 0) {
+                PANIC("could not stat %s: %s", sheet_path, strerror(errno));
+            }
+            double mb = (double) statbuf.st_size / (1024.0 * 1024.0);
+
+            double times[BENCH_RUNS];
+            long peak_rss_kib = 0;
+            for (size_t run = 0; run < BENCH_RUNS; ++run) {
+                times[run] = bench_run(BENCH_MINICEL, NULL, sheet_path, &peak_rss_kib);
+            }
+
+            double mean = 0.0;
+            for (size_t run = 0; run < BENCH_RUNS; ++run) {
+                mean += times[run];
+            }
+            mean /= BENCH_RUNS;
+
+            double variance = 0.0;
+            for (size_t run = 0; run < BENCH_RUNS; ++run) {
+                variance += (times[run] - mean) * (times[run] - mean);
+            }
+            variance /= BENCH_RUNS - 1;
+
+            qsort(times, BENCH_RUNS, sizeof(times[0]), compare_doubles);
+            double median = times[BENCH_RUNS / 2];
+            double spread = (times[BENCH_RUNS - 1] - times[0]) / median;
+            double cells = strtod(size, NULL);
+
+            printf("%-8s %10s %10.2f %10.3f %12.3f %10.2f %14.0f %10.2f %12ld\n",
+                   scenario, size, mb, median * 1e3, variance * 1e6, spread * 100.0,
+                   cells / median, mb / median, peak_rss_kib);
+            fflush(stdout);
+        }
+    }
+}
+
+// Runs `BENCH_MINICEL --parse-only` on the formula heavy scenarios
+// BENCH_RUNS times, measuring the reading and the parsing of the sheets
+// without the evaluation and the rendering.
+void parsebench(int sizes_count, char **sizes)
+{
+    if (sizes_count == 0) {
+        sizes_count = ARRAY_LEN(bench_default_sizes);
+        sizes = (char **) bench_default_sizes;
+    }
+
+    bench_build();
+
+    printf("%-8s %10s %10s %10s %14s %10s\n",
+           "scenario", "cells", "size MB", "median ms", "cells/s", "MB/s");
+    for (size_t i = 0; i < ARRAY_LEN(parsebench_scenarios); ++i) {
+        for (int j = 0; j < sizes_count; ++j) {
+            const char *scenario = parsebench_scenarios[i];
+            const char *size = sizes[j];
+            Cstr sheet_path = bench_sheet(scenario, size);
+
+            struct stat statbuf;
+            if (stat(sheet_path, &statbuf) < 0) {
+                PANIC("could not stat %s: %s", sheet_path, strerror(errno));
+            }
+            double mb = (double) statbuf.st_size / (1024.0 * 1024.0);
+
+            double times[BENCH_RUNS];
+            long peak_rss_kib = 0;
+            for (size_t run = 0; run < BENCH_RUNS; ++run) {
+                times[run] = bench_run(BENCH_MINICEL, "--parse-only", sheet_path, &peak_rss_kib);
+            }
+            double median = median_of(times, BENCH_RUNS);
+            double cells = strtod(size, NULL);
+
+            printf("%-8s %10s %10.2f %10.3f %14.0f %10.2f\n",
+                   scenario, size, mb, median * 1e3, cells / median, mb / median);
+            fflush(stdout);
+        }
+    }
+}
+
+// Performance regression gate
+//
+// `./nobuild perfcheck` runs every scenario PERFCHECK_RUNS times on a sheet
+// of PERFCHECK_CELLS cells with BENCH_MINICEL and compares the run times
+// with the ones stored in PERFCHECK_BASELINE using the one-sided
+// Mann-Whitney U test. A scenario regresses when the slowdown of the
+// median is above the threshold AND the test says it's significant, or
+// when the peak RSS grows above the threshold. The threshold is
+// PERFCHECK_THRESHOLD or the environment variable of the same name, in
+// percent.
+//
+// The stored baseline is only meaningful on the machine and with the
+// build that recorded it, the build is stored along with the times and
+// a baseline of another build is refused. `./nobuild perfcheck <rev>`
+// doesn't need one: it builds src/ of the git revision the same way and
+// measures both binaries on this machine, alternating their runs so the
+// noise of the machine hits both of them alike.
+
+#define PERFCHECK_BASELINE "perf/baseline.json"
+#define PERFCHECK_CELLS "100000"
+#define PERFCHECK_RUNS 7
+#define PERFCHECK_THRESHOLD 10.0
+#define PERFCHECK_Z 1.645 // one-sided, alpha = 0.05
+#define PERFCHECK_BASE_DIR PATH(BENCH_DIR, "base")
+#define PERFCHECK_BASE_MINICEL "./bench/minicel-base"
+
+typedef struct {
+    char name[32];
+    double times[PERFCHECK_RUNS];
+    size_t times_count;
+    long peak_rss_kib;
+} Perf_Sample;
+
+// The build of BENCH_MINICEL as it is stored in the baseline
+Cstr perf_build(void)
+{
+    return JOIN(" ", cc(), BENCH_CFLAGS);
+}
+
+void perf_sample_init(Perf_Sample *sample, Cstr scenario)
+{
+    memset(sample, 0, sizeof(*sample));
+    snprintf(sample->name, sizeof(sample->name), "%s", scenario);
+}
+
+void perf_sample_run(Perf_Sample *sample, Cstr minicel, Cstr sheet_path)
+{
+    long peak_rss_kib = 0;
+    sample->times[sample->times_count++] = bench_run(minicel, NULL, sheet_path, &peak_rss_kib);
+    if (sample->peak_rss_kib < peak_rss_kib) {
+        sample->peak_rss_kib = peak_rss_kib;
+    }
+}
+
+// Measures the scenario with BENCH_MINICEL into the `current` sample.
+// When `base_minicel` is not NULL it's measured into the `baseline`
+// sample too, one run of each at a time.
+void perf_measure(Cstr scenario, Perf_Sample *current, Cstr base_minicel, Perf_Sample *baseline)
+{
+    perf_sample_init(current, scenario);
+    if (base_minicel != NULL) {
+        perf_sample_init(baseline, scenario);
+    }
+
+    Cstr sheet_path = bench_sheet(scenario, PERFCHECK_CELLS);
+    // Warm up the page cache
+    long peak_rss_kib = 0;
+    bench_run(BENCH_MINICEL, NULL, sheet_path, &peak_rss_kib);
+    for (size_t run = 0; run < PERFCHECK_RUNS; ++run) {
+        if (base_minicel != NULL) {
+            perf_sample_run(baseline, base_minicel, sheet_path);
+        }
+        perf_sample_run(current, BENCH_MINICEL, sheet_path);
+    }
+}
+
+// Builds src/ of the git revision the same way as BENCH_MINICEL
+void perf_build_revision(Cstr rev)
+{
+    MKDIRS(BENCH_DIR, "base");
+    Cstr files[] = {"main.c", "sv.h"};
+    for (size_t i = 0; i < ARRAY_LEN(files); ++i) {
+        CHAIN(CHAIN_CMD("git", "show", CONCAT(rev, ":src/", files[i])),
+              OUT(PATH(PERFCHECK_BASE_DIR, files[i])));
+    }
+    CMD(cc(), BENCH_CFLAGS, "-o", PERFCHECK_BASE_MINICEL, PATH(PERFCHECK_BASE_DIR, "main.c") MINICEL_LIBS);
+}
+
+void perf_write_baseline(const Perf_Sample *samples, size_t count)
+{
+    MKDIRS("perf");
+    FILE *f = fopen(PERFCHECK_BASELINE, "wb");
+    if (f == NULL) {
+        PANIC("could not write %s: %s", PERFCHECK_BASELINE, strerror(errno));
+    }
+
+    // One scenario per line, perf_read_baseline() depends on that
+    fprintf(f, "{\n  \"cells\": %s,\n  \"build\": \"%s\",\n  \"scenarios\": [\n",
+            PERFCHECK_CELLS, perf_build());
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(f, "    {\"name\": \"%s\", \"peak_rss_kib\": %ld, \"times_ms\": [",
+                samples[i].name, samples[i].peak_rss_kib);
+        for (size_t j = 0; j < samples[i].times_count; ++j) {
+            fprintf(f, "%s%.3f", j > 0 ? ", " : "", samples[i].times[j] * 1e3);
+        }
+        fprintf(f, "]}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    INFO("Recorded the baseline into %s", PERFCHECK_BASELINE);
+}
+
+// Refuses the baseline recorded with another build of BENCH_MINICEL,
+// its times can't be compared with the current ones
+void perf_check_baseline_build(void)
+{
+    FILE *f = fopen(PERFCHECK_BASELINE, "rb");
+    if (f == NULL) {
+        PANIC("could not read %s: %s. Record it with `./nobuild perfcheck update`",
+              PERFCHECK_BASELINE, strerror(errno));
+    }
+
+    const char *prefix = "\"build\": \"";
+    char line[4096];
+    char *build = NULL;
+    while (build == NULL && fgets(line, sizeof(line), f) != NULL) {
+        build = strstr(line, prefix);
+    }
+    fclose(f);
+
+    if (build == NULL) {
+        PANIC("%s doesn't say what build it was recorded with. Record it again with `./nobuild perfcheck update`",
+              PERFCHECK_BASELINE);
+    }
+    build += strlen(prefix);
+    char *end = strchr(build, '"');
+    if (end != NULL) *end = '\0';
+
+    Cstr expected = perf_build();
+    if (strcmp(build, expected) != 0) {
+        PANIC("%s was recorded with `%s`, not `%s`. Record it again with `./nobuild perfcheck update` "
+              "or compare with a git revision instead: `./nobuild perfcheck <rev>`",
+              PERFCHECK_BASELINE, build, expected);
+    }
+}
+
+// Returns false when the baseline has no such scenario
+bool perf_read_baseline(Cstr scenario, Perf_Sample *sample)
+{
+    FILE *f = fopen(PERFCHECK_BASELINE, "rb");
+    if (f == NULL) {
+        PANIC("could not read %s: %s. Record it with `./nobuild perfcheck update`",
+              PERFCHECK_BASELINE, strerror(errno));
+    }
+
+    char needle[64];
+    snprintf(needle, sizeof(needle), "{\"name\": \"%s\"", scenario);
+
+    char line[4096];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f) != NULL) {
+        char *p = strstr(line, needle);
+        if (p == NULL) {
+            continue;
+        }
+
+        memset(sample, 0, sizeof(*sample));
+        snprintf(sample->name, sizeof(sample->name), "%s", scenario);
+
+        char *rss = strstr(p, "\"peak_rss_kib\":");
+        char *times = strstr(p, "\"times_ms\": [");
+        if (rss == NULL || times == NULL) {
+            PANIC("%s: malformed entry of %s", PERFCHECK_BASELINE, scenario);
+        }
+        sample->peak_rss_kib = strtol(rss + strlen("\"peak_rss_kib\":"), NULL, 10);
+
+        char *q = times + strlen("\"times_ms\": [");
+        while (*q != ']' && sample->times_count < PERFCHECK_RUNS) {
+            char *end = NULL;
+            double ms = strtod(q, &end);
+            if (end == q) {
+                PANIC("%s: malformed times of %s", PERFCHECK_BASELINE, scenario);
+            }
+            sample->times[sample->times_count++] = ms * 1e-3;
+            q = end;
+            while (*q == ',' || *q == ' ') q += 1;
+        }
+        found = sample->times_count > 0;
+    }
+
+    fclose(f);
+    return found;
+}
+
+// Is `current` significantly slower than `baseline` according to the
+// one-sided Mann-Whitney U test with the normal approximation?
+bool perf_significantly_slower(const Perf_Sample *baseline, const Perf_Sample *current)
+{
+    double n1 = (double) current->times_count;
+    double n2 = (double) baseline->times_count;
+
+    // U counts the pairs where the current run is slower, ties count half
+    double u = 0.0;
+    for (size_t i = 0; i < current->times_count; ++i) {
+        for (size_t j = 0; j < baseline->times_count; ++j) {
+            if (current->times[i] > baseline->times[j]) {
+                u += 1.0;
+            } else if (current->times[i] == baseline->times[j]) {
+                u += 0.5;
+            }
+        }
+    }
+
+    double mean = n1 * n2 / 2.0;
+    double variance = n1 * n2 * (n1 + n2 + 1.0) / 12.0;
+    // z = (u - mean) / sqrt(variance) > PERFCHECK_Z without the sqrt
+    return u > mean && (u - mean) * (u - mean) > PERFCHECK_Z * PERFCHECK_Z * variance;
+}
+
+void perfcheck(int argc, char **argv)
+{
+    bench_build();
+
+    bool update = argc > 0 && strcmp(argv[0], "update") == 0;
+    Cstr rev = argc > 0 && !update ? argv[0] : NULL;
+    if (rev != NULL) {
+        perf_build_revision(rev);
+    } else if (!update) {
+        perf_check_baseline_build();
+    }
+
+    Perf_Sample samples[ARRAY_LEN(bench_scenarios)];
+    Perf_Sample baselines[ARRAY_LEN(bench_scenarios)] = {0};
+    for (size_t i = 0; i < ARRAY_LEN(bench_scenarios); ++i) {
+        perf_measure(bench_scenarios[i], &samples[i],
+                     rev != NULL ? PERFCHECK_BASE_MINICEL : NULL, &baselines[i]);
+    }
+
+    if (update) {
+        perf_write_baseline(samples, ARRAY_LEN(samples));
+        return;
+    }
+
+    double threshold = PERFCHECK_THRESHOLD;
+    const char *threshold_env = getenv("PERFCHECK_THRESHOLD");
+    if (threshold_env != NULL) {
+        threshold = strtod(threshold_env, NULL);
+    }
+
+    printf("%-8s %12s %12s %9s %12s %12s %9s  %s\n",
+           "scenario", "base ms", "current ms", "time %", "base KiB", "current KiB", "rss %", "verdict");
+
+    size_t regressions = 0;
+    for (size_t i = 0; i < ARRAY_LEN(samples); ++i) {
+        Perf_Sample baseline = baselines[i];
+        if (rev == NULL && !perf_read_baseline(samples[i].name, &baseline)) {
+            WARN("%s is not in %s, skipping it", samples[i].name, PERFCHECK_BASELINE);
+            continue;
+        }
+
+        double base_median = median_of(baseline.times, baseline.times_count);
+        double current_median = median_of(samples[i].times, samples[i].times_count);
+        double time_change = (current_median / base_median - 1.0) * 100.0;
+        double rss_change = ((double) samples[i].peak_rss_kib / (double) baseline.peak_rss_kib - 1.0) * 100.0;
+
+        const char *verdict = "ok";
+        if (time_change > threshold && perf_significantly_slower(&baseline, &samples[i])) {
+            verdict = "SLOWER";
+            regressions += 1;
+        } else if (rss_change > threshold) {
+            verdict = "MORE MEMORY";
+            regressions += 1;
+        }
+
+        printf("%-8s %12.3f %12.3f %+8.1f%% %12ld %12ld %+8.1f%%  %s\n",
+               samples[i].name, base_median * 1e3, current_median * 1e3, time_change,
+               baseline.peak_rss_kib, samples[i].peak_rss_kib, rss_change, verdict);
+    }
+
+    if (regressions > 0) {
+        PANIC("%zu scenario(s) regressed past the %.1f%% threshold", regressions, threshold);
+    }
+    INFO("No regressions past the %.1f%% threshold", threshold);
+}
+
+// Regression tests
+//
+// `./nobuild run` and `./nobuild valgrind` run ./minicel with the options
+// of every case below on csv/tests/<name>.csv and compare its standard
+// output with csv/tests/<name>.out, and its standard error with
+// csv/tests/<name>.err when there is one. The outputs of the last run are
+// kept in TEST_DIR. Under valgrind a memory error fails the case too.
+//
+// A `serve` case is a session with the daemon instead: the requests of
+// csv/tests/<name>.req are sent to `./minicel --serve` one by one and the
+// output is every request followed by its response.
+
+#define TEST_DIR PATH(BENCH_DIR, "tests")
+#define TEST_CSV_DIR "csv/tests"
+// The exit code valgrind reports the memory errors with
+#define TEST_VALGRIND_EXIT_CODE 125
+// How long the daemon may take to start listening, under valgrind too
+#define TEST_SERVE_TIMEOUT_SECS 30.0
+
+// How a case damages the --cache it runs with
+typedef enum {
+    TEST_CACHE_NONE = 0,
+    // Only the first half of the cache is left
+    TEST_CACHE_TRUNCATED,
+    // The last byte, the top byte of the last cell offset of the cache
+    // written in little endian, is flipped
+    TEST_CACHE_FLIPPED,
+} Test_Cache;
+
+typedef struct {
+    Cstr name;
+    Cstr args[8];
+    int exit_code;
+    // The input is csv/tests/<input>.csv instead of the one named after
+    // the case
+    Cstr input;
+    // The expected output is the outputs of these cases separated by
+    // empty lines instead of csv/tests/<name>.out, for the options that
+    // must output the same as the other ways to get it
+    Cstr parts[4];
+    // The input is generated with `./gen <gen_scenario> <gen_cells>`
+    // instead of being checked in
+    Cstr gen_scenario;
+    Cstr gen_cells;
+    bool serve;
+    // The case runs with a --cache written by a run on the same input and
+    // damaged then. It must output exactly what a run without one does.
+    Test_Cache cache;
+} Test_Case;
+
+static const Test_Case test_cases[] = {
+    {
+        .name = "reassociate-100k",
+        .args = {"--reassociate", "--cells", "A0"},
+        .gen_scenario = "sum",
+        .gen_cells = "100001",
+    },
+    {
+        .name = "sweep-100k",
+        .args = {"--sweep", TEST_CSV_DIR"/sweep_sum_scenarios.csv", "--cells", "A0"},
+        .gen_scenario = "sum",
+        .gen_cells = "100001",
+    },
+    {
+        .name = "fill",
+    },
+    {
+        .name = "fill-top",
+        .exit_code = 1,
+    },
+    {
+        .name = "names",
+    },
+    {
+        .name = "names-unknown",
+        .exit_code = 1,
+    },
+    {
+        .name = "sheet",
+    },
+    {
+        .name = "sheet-missing",
+        .exit_code = 1,
+    },
+    {
+        .name = "sheet-cycle",
+        .exit_code = 1,
+    },
+    {
+        .name = "project-rows",
+        .args = {"--rows", "0,3:4"},
+        .input = "project",
+    },
+    {
+        .name = "project-columns",
+        .args = {"--columns", "A,D:E"},
+        .exit_code = 1,
+        .input = "project",
+    },
+    {
+        .name = "project-cells",
+        .args = {"--cells", "D4,C4,E3"},
+        .input = "project",
+    },
+    {
+        .name = "head-rows",
+        .args = {"--rows", "0:2"},
+        .input = "head",
+    },
+    {
+        .name = "head",
+        .args = {"--head", "3"},
+        .parts = {"head-rows"},
+    },
+    {
+        .name = "head-past-end",
+        .args = {"--head", "2"},
+        .exit_code = 1,
+    },
+    // sweep-<n>.csv is sweep.csv with the inputs of the scenario <n>
+    {
+        .name = "sweep-0",
+    },
+    {
+        .name = "sweep-1",
+        .exit_code = 1,
+    },
+    {
+        .name = "sweep-2",
+    },
+    {
+        .name = "sweep",
+        .args = {"--sweep", TEST_CSV_DIR"/sweep_scenarios.csv"},
+        .exit_code = 1,
+        .parts = {"sweep-0", "sweep-1", "sweep-2"},
+    },
+    {
+        .name = "hashcons",
+        .exit_code = 1,
+    },
+    // An optimization must not change the output nor the diagnostics
+    {
+        .name = "hashcons-shared",
+        .args = {"--hashcons"},
+        .exit_code = 1,
+        .input = "hashcons",
+        .parts = {"hashcons"},
+    },
+    {
+        .name = "cache",
+        .exit_code = 1,
+    },
+    {
+        .name = "cache-truncated",
+        .exit_code = 1,
+        .input = "cache",
+        .parts = {"cache"},
+        .cache = TEST_CACHE_TRUNCATED,
+    },
+    {
+        .name = "cache-flipped",
+        .exit_code = 1,
+        .input = "cache",
+        .parts = {"cache"},
+        .cache = TEST_CACHE_FLIPPED,
+    },
+    {
+        .name = "fork",
+        .serve = true,
+    },
+    {
+        .name = "recalc",
+        .serve = true,
+    },
+};
+
+// Starts the command with the standard streams redirected to the files,
+// NULL leaves the stream alone
+pid_t test_spawn(Cstr *args, Cstr in_path, Cstr out_path, Cstr err_path)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        PANIC("could not fork: %s", strerror(errno));
+    }
+
+    if (pid == 0) {
+        Cstr paths[] = {in_path, out_path, err_path};
+        int flags[] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_TRUNC};
+        for (int stream = 0; stream < 3; ++stream) {
+            if (paths[stream] == NULL) {
+                continue;
+            }
+            int fd = open(paths[stream], flags[stream], 0644);
+            if (fd < 0 || dup2(fd, stream) < 0) {
+                PANIC("could not redirect to %s: %s", paths[stream], strerror(errno));
+            }
+            close(fd);
+        }
+        execvp(args[0], (char * const *) args);
+        PANIC("could not exec %s: %s", args[0], strerror(errno));
+    }
+    return pid;
+}
+
+// Returns the exit code, or 128 plus the number of the signal that
+// killed the command
+int test_wait(pid_t pid, Cstr *args)
+{
+    int wstatus = 0;
+    if (waitpid(pid, &wstatus, 0) < 0) {
+        PANIC("could not wait on %s: %s", args[0], strerror(errno));
+    }
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+}
+
+int test_exec(Cstr *args, Cstr in_path, Cstr out_path, Cstr err_path)
+{
+    return test_wait(test_spawn(args, in_path, out_path, err_path), args);
+}
+
+// Sends the requests of `req_path` to the daemon listening on
+// `socket_path` and writes every one of them, prefixed with `> `, and
+// its response into `out_path`
+bool test_session(Cstr name, Cstr socket_path, Cstr req_path, Cstr out_path)
+{
+    FILE *requests = fopen(req_path, "rb");
+    if (requests == NULL) {
+        ERRO("%s: could not read %s: %s", name, req_path, strerror(errno));
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        PANIC("could not create socket: %s", strerror(errno));
+    }
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    double deadline = bench_now_secs() + TEST_SERVE_TIMEOUT_SECS;
+    while (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        if (bench_now_secs() > deadline) {
+            ERRO("%s: could not connect to %s: %s", name, socket_path, strerror(errno));
+            close(fd);
+            fclose(requests);
+            return false;
+        }
+        struct timespec delay = {.tv_nsec = 10 * 1000 * 1000};
+        nanosleep(&delay, NULL);
+    }
+
+    FILE *responses = fdopen(dup(fd), "r");
+    FILE *out = fopen(out_path, "wb");
+    if (responses == NULL || out == NULL) {
+        PANIC("could not open the session streams: %s", strerror(errno));
+    }
+
+    char line[4096];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), requests) != NULL) {
+        fprintf(out, "> %s", line);
+        // A daemon that died must fail the case, not kill nobuild
+        ok = send(fd, line, strlen(line), MSG_NOSIGNAL) == (ssize_t) strlen(line);
+
+        size_t lines = 1;
+        for (size_t i = 0; ok && i < lines; ++i) {
+            char response[4096];
+            ok = fgets(response, sizeof(response), responses) != NULL;
+            if (ok) {
+                fputs(response, out);
+                if (i == 0 && strncmp(response, "OK ", 3) == 0) {
+                    lines += strtoul(response + 3, NULL, 10);
+                }
+            }
+        }
+    }
+    if (!ok) {
+        ERRO("%s: the daemon hung up", name);
+    }
+
+    fclose(out);
+    fclose(responses);
+    close(fd);
+    fclose(requests);
+    return ok;
+}
+
+// NULL when the file doesn't exist
+char *test_slurp(Cstr path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    char *data = NULL;
+    *size = 0;
+    size_t capacity = 0;
+    for (;;) {
+        if (*size + 4096 > capacity) {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            data = realloc(data, capacity);
+        }
+        size_t n = fread(data + *size, 1, capacity - *size, f);
+        if (n == 0) {
+            break;
+        }
+        *size += n;
+    }
+    fclose(f);
+    return data;
+}
+
+// Writes a cache of the input into `cache_path` and damages it
+void test_damage_cache(const Test_Case *test, Cstr input_path, Cstr cache_path)
+{
+    remove(cache_path);
+    Cstr args[] = {"./minicel", "--cache", cache_path, input_path, NULL};
+    test_exec(args, NULL, "/dev/null", "/dev/null");
+
+    size_t size = 0;
+    char *data = test_slurp(cache_path, &size);
+    if (data == NULL || size == 0) {
+        PANIC("%s: could not write the cache %s", test->name, cache_path);
+    }
+
+    switch (test->cache) {
+    case TEST_CACHE_TRUNCATED:
+        size /= 2;
+        break;
+    case TEST_CACHE_FLIPPED:
+        data[size - 1] ^= 0xFF;
+        break;
+    case TEST_CACHE_NONE:
+    default:
+        PANIC("%s: the case does not damage the cache", test->name);
+    }
+
+    FILE *f = fopen(cache_path, "wb");
+    if (f == NULL || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+        PANIC("%s: could not damage the cache %s", test->name, cache_path);
+    }
+    free(data);
+}
+
+// Joins the expected outputs of the `parts` into `path`
+void test_join_parts(const Test_Case *test, Cstr path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        PANIC("could not open %s: %s", path, strerror(errno));
+    }
+    for (size_t i = 0; i < ARRAY_LEN(test->parts) && test->parts[i] != NULL; ++i) {
+        Cstr part_path = PATH(TEST_CSV_DIR, CONCAT(test->parts[i], ".out"));
+        size_t size = 0;
+        char *part = test_slurp(part_path, &size);
+        if (part == NULL) {
+            PANIC("could not read %s: %s", part_path, strerror(errno));
+        }
+        if (i > 0) {
+            fputc('\n', f);
+        }
+        fwrite(part, 1, size, f);
+        free(part);
+    }
+    fclose(f);
+}
+
+// Compares the actual output with the expected one, shows the difference
+// when they don't match
+bool test_compare(Cstr name, Cstr expected_path, Cstr actual_path)
+{
+    size_t expected_size = 0;
+    char *expected = test_slurp(expected_path, &expected_size);
+    if (expected == NULL) {
+        ERRO("%s: could not read %s: %s", name, expected_path, strerror(errno));
+        return false;
+    }
+
+    size_t actual_size = 0;
+    char *actual = test_slurp(actual_path, &actual_size);
+    bool same = actual != NULL && actual_size == expected_size &&
+                memcmp(actual, expected, expected_size) == 0;
+    free(expected);
+    free(actual);
+
+    if (!same) {
+        ERRO("%s: %s differs from %s", name, actual_path, expected_path);
+        Cstr diff[] = {"diff", "-u", expected_path, actual_path, NULL};
+        test_exec(diff, NULL, NULL, NULL);
+    }
+    return same;
+}
+
+bool test_run(const Test_Case *test, bool valgrind)
+{
+    Cstr input_path = test->gen_scenario != NULL
+        ? bench_sheet(test->gen_scenario, test->gen_cells)
+        : PATH(TEST_CSV_DIR, CONCAT(test->input ? test->input : test->name, ".csv"));
+    Cstr out_path = PATH(TEST_DIR, CONCAT(test->name, ".out"));
+    Cstr err_path = PATH(TEST_DIR, CONCAT(test->name, ".err"));
+    Cstr log_path = PATH(TEST_DIR, CONCAT(test->name, ".valgrind"));
+
+    Cstr args[32];
+    size_t count = 0;
+    if (valgrind) {
+        args[count++] = "valgrind";
+        args[count++] = "-q";
+        // TEST_VALGRIND_EXIT_CODE
+        args[count++] = "--error-exitcode=125";
+        args[count++] = CONCAT("--log-file=", log_path);
+    }
+    args[count++] = "./minicel";
+    for (size_t i = 0; i < ARRAY_LEN(test->args) && test->args[i] != NULL; ++i) {
+        args[count++] = test->args[i];
+    }
+
+    if (test->cache != TEST_CACHE_NONE) {
+        Cstr cache_path = PATH(TEST_DIR, CONCAT(test->name, ".cache"));
+        test_damage_cache(test, input_path, cache_path);
+        args[count++] = "--cache";
+        args[count++] = cache_path;
+    }
+
+    int exit_code = 0;
+    if (test->serve) {
+        Cstr socket_path = PATH(TEST_DIR, CONCAT(test->name, ".sock"));
+        args[count++] = "--serve";
+        args[count++] = socket_path;
+        args[count++] = NULL;
+
+        pid_t pid = test_spawn(args, NULL, NULL, err_path);
+        bool session = test_session(test->name, socket_path,
+                                    PATH(TEST_CSV_DIR, CONCAT(test->name, ".req")), out_path);
+        // The daemon stops on SIGTERM
+        kill(pid, SIGTERM);
+        exit_code = test_wait(pid, args);
+        if (!session) {
+            return false;
+        }
+    } else {
+        args[count++] = input_path;
+        args[count++] = NULL;
+        exit_code = test_exec(args, NULL, out_path, err_path);
+    }
+    if (valgrind && exit_code == TEST_VALGRIND_EXIT_CODE) {
+        ERRO("%s: valgrind found memory errors, see %s", test->name, log_path);
+        return false;
+    }
+
+    bool ok = true;
+    if (exit_code != test->exit_code) {
+        ERRO("%s: exited with %d instead of %d", test->name, exit_code, test->exit_code);
+        ok = false;
+    }
+    Cstr expected_path = PATH(TEST_CSV_DIR, CONCAT(test->name, ".out"));
+    if (test->parts[0] != NULL) {
+        expected_path = PATH(TEST_DIR, CONCAT(test->name, ".expected"));
+        test_join_parts(test, expected_path);
+    }
+    ok = test_compare(test->name, expected_path, out_path) && ok;
+
+    Cstr expected_err_path = PATH(TEST_CSV_DIR, CONCAT(test->name, ".err"));
+    if (PATH_EXISTS(expected_err_path)) {
+        ok = test_compare(test->name, expected_err_path, err_path) && ok;
+    }
+    return ok;
+}
+
+void run_tests(bool valgrind)
+{
+    CMD(cc(), BENCH_CFLAGS, "-o", "gen", "src/gen.c");
+    MKDIRS(BENCH_DIR, "tests");
+
+    size_t failed = 0;
+    for (size_t i = 0; i < ARRAY_LEN(test_cases); ++i) {
+        if (test_run(&test_cases[i], valgrind)) {
+            INFO("TEST: %s: ok", test_cases[i].name);
+        } else {
+            failed += 1;
+        }
+    }
+
+    if (failed > 0) {
+        PANIC("%zu of %zu test(s) failed", failed, ARRAY_LEN(test_cases));
+    }
+    INFO("All %zu test(s) passed", ARRAY_LEN(test_cases));
+}
+
 int posix_main(int argc, char **argv)
 {
-    CMD(cc(), CFLAGS, "-o", "minicel", "src/main.c");
+    CMD(cc(), CFLAGS, "-o", "minicel", "src/main.c" MINICEL_LIBS);
+    CMD(cc(), CFLAGS, "-o", "loadgen", "src/loadgen.c");
 
     if (argc > 1) {
         if (strcmp(argv[1], "run") == 0) {
             CMD("./minicel", CSV_FILE_PATH);
+            run_tests(false);
         } else if (strcmp(argv[1], "gdb") == 0) {
             CMD("gdb", "./minicel");
         } else if (strcmp(argv[1], "valgrind") == 0) {
             CMD("valgrind", "--error-exitcode=1", "./minicel", CSV_FILE_PATH);
+            run_tests(true);
+        } else if (strcmp(argv[1], "bench") == 0) {
+            bench(argc - 2, argv + 2);
+        } else if (strcmp(argv[1], "parsebench") == 0) {
+            parsebench(argc - 2, argv + 2);
+        } else if (strcmp(argv[1], "perfcheck") == 0) {
+            perfcheck(argc - 2, argv + 2);
         } else {
             PANIC("%s is unknown subcommand", argv[1]);
         }
@@ -31,6 +1038,7 @@ int posix_main(int argc, char **argv)
 
     return 0;
 }
+#endif // _WIN32
 
 int msvc_main(int argc, char **argv)
 {
@@ -0,0 +1,227 @@
+// Synthetic sheet generator for `./nobuild bench`
+//
+// Writes a sheet of roughly the requested amount of cells shaped after one
+// of the scenarios below. The output only depends on the arguments, so the
+// benchmarks are repeatable.
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef enum {
+    SCENARIO_CHAIN = 0,
+    SCENARIO_WIDE,
+    SCENARIO_CLONE,
+    SCENARIO_FILL,
+    SCENARIO_FANIN,
+    SCENARIO_TEXT,
+    SCENARIO_NUMERIC,
+    SCENARIO_SUM,
+    COUNT_SCENARIOS,
+} Scenario;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    size_t cols;
+} Scenario_Def;
+
+static const Scenario_Def scenario_defs[COUNT_SCENARIOS] = {
+    [SCENARIO_CHAIN] = {
+        .name = "chain",
+        .description = "every cell depends on the one above it",
+        .cols = 4,
+    },
+    [SCENARIO_WIDE] = {
+        .name = "wide",
+        .description = "independent columns, formulas only reference their own row",
+        .cols = 16,
+    },
+    [SCENARIO_CLONE] = {
+        .name = "clone",
+        .description = "a row of formulas cloned down the whole sheet",
+        .cols = 8,
+    },
+    [SCENARIO_FILL] = {
+        .name = "fill",
+        .description = "the clone sheet with a `:^*` fill instead of the `:^` cells",
+        .cols = 8,
+    },
+    [SCENARIO_FANIN] = {
+        .name = "fanin",
+        .description = "a column of numbers with a total of the previous 1000 rows every 1000 rows",
+        .cols = 2,
+    },
+    [SCENARIO_TEXT] = {
+        .name = "text",
+        .description = "mostly text cells",
+        .cols = 8,
+    },
+    [SCENARIO_NUMERIC] = {
+        .name = "numeric",
+        .description = "numbers only",
+        .cols = 8,
+    },
+    [SCENARIO_SUM] = {
+        .name = "sum",
+        .description = "a column of numbers with their total on top as one long `+` chain",
+        .cols = 1,
+    },
+};
+
+#define FANIN_BLOCK 1000
+
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./gen <scenario> <cells> [output.csv]\n");
+    fprintf(stream, "Scenarios:\n");
+    for (Scenario s = 0; s < COUNT_SCENARIOS; ++s) {
+        fprintf(stream, "    %-10s %s\n", scenario_defs[s].name, scenario_defs[s].description);
+    }
+}
+
+// Column name as it's used in the cell references
+char col_name(size_t col)
+{
+    assert(col < 26);
+    return (char) ('A' + col);
+}
+
+void gen_cell(FILE *out, Scenario scenario, size_t rows, size_t row, size_t col)
+{
+    switch (scenario) {
+    case SCENARIO_CHAIN:
+        if (row == 0) {
+            fprintf(out, "%zu", col + 1);
+        } else {
+            fprintf(out, "=%c%zu+1", col_name(col), row - 1);
+        }
+        break;
+
+    case SCENARIO_WIDE:
+        if (col % 2 == 0) {
+            fprintf(out, "%zu.%zu", row % 1000, col);
+        } else {
+            fprintf(out, "=%c%zu*2+%c%zu", col_name(col - 1), row, col_name(col - 1), row);
+        }
+        break;
+
+    case SCENARIO_CLONE:
+    case SCENARIO_FILL:
+        if (row == 0) {
+            fprintf(out, "%zu", col);
+        } else if (row == 1) {
+            if (col == 0) {
+                fprintf(out, "=A0+1");
+            } else {
+                fprintf(out, "=%c1+%c0", col_name(col - 1), col_name(col));
+            }
+        } else if (scenario == SCENARIO_CLONE) {
+            fprintf(out, ":^");
+        } else if (row == 2) {
+            fprintf(out, ":^*");
+        }
+        break;
+
+    case SCENARIO_FANIN:
+        if (col == 0) {
+            fprintf(out, "%zu", row % 100);
+        } else if (row % FANIN_BLOCK == FANIN_BLOCK - 1) {
+            fprintf(out, "=");
+            for (size_t i = row + 1 - FANIN_BLOCK; i <= row; ++i) {
+                fprintf(out, "%sA%zu", i > row + 1 - FANIN_BLOCK ? "+" : "", i);
+            }
+        }
+        break;
+
+    case SCENARIO_TEXT:
+        if (col == 0) {
+            fprintf(out, "%zu", row);
+        } else {
+            fprintf(out, "item %zu of row %zu", col, row);
+        }
+        break;
+
+    case SCENARIO_NUMERIC:
+        fprintf(out, "%zu.%02zu", row * 7 + col, (row + col) % 100);
+        break;
+
+    case SCENARIO_SUM:
+        if (row == 0) {
+            fprintf(out, "=");
+            for (size_t i = 1; i < rows; ++i) {
+                fprintf(out, "%sA%zu", i > 1 ? "+" : "", i);
+            }
+        } else {
+            fprintf(out, "%zu", row % 100);
+        }
+        break;
+
+    case COUNT_SCENARIOS:
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: not enough arguments\n");
+        exit(1);
+    }
+
+    const char *scenario_name = argv[1];
+    Scenario scenario = 0;
+    while (scenario < COUNT_SCENARIOS && strcmp(scenario_defs[scenario].name, scenario_name) != 0) {
+        scenario += 1;
+    }
+    if (scenario >= COUNT_SCENARIOS) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: unknown scenario %s\n", scenario_name);
+        exit(1);
+    }
+
+    char *endptr = NULL;
+    size_t cells = strtoul(argv[2], &endptr, 10);
+    if (*argv[2] == '\0' || *endptr != '\0' || cells == 0) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: %s is not a valid amount of cells\n", argv[2]);
+        exit(1);
+    }
+
+    FILE *out = stdout;
+    if (argc > 3) {
+        out = fopen(argv[3], "wb");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: could not open %s: %s\n", argv[3], strerror(errno));
+            exit(1);
+        }
+    }
+
+    size_t cols = scenario_defs[scenario].cols;
+    size_t rows = (cells + cols - 1) / cols;
+    for (size_t row = 0; row < rows; ++row) {
+        // The rows below the fill are empty lines
+        if (scenario == SCENARIO_FILL && row > 2) {
+            fputc('\n', out);
+            continue;
+        }
+
+        for (size_t col = 0; col < cols; ++col) {
+            if (col > 0) {
+                fputc('|', out);
+            }
+            gen_cell(out, scenario, rows, row, col);
+        }
+        fputc('\n', out);
+    }
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "ERROR: could not write the sheet: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Load generator for `minicel --serve`
+//
+// Loads a sheet into a running daemon, then alternates between changing
+// one cell and reading another one back, measuring the latency of every
+// request.
+#define _XOPEN_SOURCE 700
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./loadgen <socket> <input.csv> <set-cell> <get-cell> [requests]\n");
+}
+
+double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Sends the request and consumes the response. Returns 0 on `OK`.
+int request(FILE *in, int fd, const char *line)
+{
+    size_t size = strlen(line);
+    while (size > 0) {
+        ssize_t n = write(fd, line, size);
+        if (n <= 0) {
+            fprintf(stderr, "ERROR: could not send request: %s\n", strerror(errno));
+            exit(1);
+        }
+        line += n;
+        size -= (size_t) n;
+    }
+
+    char response[4096];
+    if (fgets(response, sizeof(response), in) == NULL) {
+        fprintf(stderr, "ERROR: connection closed by the server\n");
+        exit(1);
+    }
+
+    size_t payload = 0;
+    if (sscanf(response, "OK %zu", &payload) != 1) {
+        fprintf(stderr, "ERROR: %s", response);
+        return 1;
+    }
+
+    for (size_t i = 0; i < payload; ++i) {
+        // Payload lines may be longer than the buffer, consume them whole
+        int c = 0;
+        while ((c = fgetc(in)) != EOF && c != '\n');
+        if (c == EOF) {
+            fprintf(stderr, "ERROR: connection closed by the server\n");
+            exit(1);
+        }
+    }
+
+    return 0;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+void report(const char *name, double *latencies, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    qsort(latencies, count, sizeof(*latencies), compare_doubles);
+
+    const double ps[] = {0.50, 0.90, 0.99, 0.999};
+    printf("%-4s latency:", name);
+    for (size_t i = 0; i < sizeof(ps) / sizeof(ps[0]); ++i) {
+        size_t k = (size_t) (ps[i] * (double) (count - 1));
+        printf(" p%g %.1fus", ps[i] * 100.0, latencies[k] * 1e6);
+    }
+    printf(" max %.1fus\n", latencies[count - 1] * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 5) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: not enough arguments\n");
+        exit(1);
+    }
+
+    const char *socket_path = argv[1];
+    const char *input_file_path = argv[2];
+    const char *set_cell = argv[3];
+    const char *get_cell = argv[4];
+    size_t requests = argc > 5 ? strtoul(argv[5], NULL, 10) : 100000;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path %s is too long\n", socket_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "ERROR: could not connect to %s: %s\n", socket_path, strerror(errno));
+        exit(1);
+    }
+    FILE *in = fdopen(fd, "r");
+
+    // The daemon resolves the path relative to its own working directory
+    char *input_real_path = realpath(input_file_path, NULL);
+    if (input_real_path == NULL) {
+        fprintf(stderr, "ERROR: could not resolve %s: %s\n", input_file_path, strerror(errno));
+        exit(1);
+    }
+
+    char line[4096];
+    snprintf(line, sizeof(line), "load loadgen %s\n", input_real_path);
+    if (request(in, fd, line) != 0) {
+        exit(1);
+    }
+
+    double *set_latencies = malloc(sizeof(double) * requests);
+    double *get_latencies = malloc(sizeof(double) * requests);
+    size_t set_count = 0;
+    size_t get_count = 0;
+    size_t errors = 0;
+
+    double begin = now_secs();
+    for (size_t i = 0; i < requests; ++i) {
+        if (i % 2 == 0) {
+            snprintf(line, sizeof(line), "set loadgen %s %zu\n", set_cell, i);
+        } else {
+            snprintf(line, sizeof(line), "get loadgen %s\n", get_cell);
+        }
+
+        double start = now_secs();
+        errors += request(in, fd, line);
+        double latency = now_secs() - start;
+
+        if (i % 2 == 0) {
+            set_latencies[set_count++] = latency;
+        } else {
+            get_latencies[get_count++] = latency;
+        }
+    }
+    double elapsed = now_secs() - begin;
+
+    printf("requests:   %zu (%zu errors)\n", requests, errors);
+    printf("elapsed:    %.3fs\n", elapsed);
+    printf("throughput: %.1f req/s\n", (double) requests / elapsed);
+    report("set", set_latencies, set_count);
+    report("get", get_latencies, get_count);
+
+    snprintf(line, sizeof(line), "unload loadgen\n");
+    request(in, fd, line);
+
+    free(set_latencies);
+    free(get_latencies);
+    free(input_real_path);
+    fclose(in);
+
+    return 0;
+}
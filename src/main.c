@@ -1,8 +1,28 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#endif // _WIN32
+
+#ifdef __linux__
+#include <limits.h>
+#include <sys/inotify.h>
+#endif // __linux__
 
 #define SV_IMPLEMENTATION
 #include "./sv.h"
@@ -14,6 +34,195 @@
         exit(69);                                    \
     } while(0)
 
+// Statistics (--stats)
+//
+// The phases are timed with stats_begin()/stats_end() which do nothing
+// unless the statistics are enabled. The phases never nest.
+
+typedef enum {
+    PHASE_READ = 0,
+    PHASE_CACHE,
+    PHASE_ESTIMATE,
+    PHASE_PARSE,
+    PHASE_OPTIMIZE,
+    PHASE_EVAL,
+    PHASE_WIDTHS,
+    PHASE_RENDER,
+    COUNT_PHASES,
+} Phase;
+
+static const char *phase_names[COUNT_PHASES] = {
+    [PHASE_READ]     = "read",
+    [PHASE_CACHE]    = "cache",
+    [PHASE_ESTIMATE] = "estimate",
+    [PHASE_PARSE]    = "parse",
+    [PHASE_OPTIMIZE] = "optimize",
+    [PHASE_EVAL]     = "eval",
+    [PHASE_WIDTHS]   = "widths",
+    [PHASE_RENDER]   = "render",
+};
+
+typedef struct {
+    bool enabled;
+    double wall_start;
+    double cpu_start;
+    double wall[COUNT_PHASES];
+    double cpu[COUNT_PHASES];
+
+    // Maintained even when the statistics are disabled, it's just a couple
+    // of increments per expression node
+    size_t eval_depth;
+    size_t max_eval_depth;
+} Stats;
+
+Stats stats = {0};
+
+double clock_wall_secs(void)
+{
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif // _WIN32
+}
+
+double clock_cpu_secs(void)
+{
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif // _WIN32
+}
+
+// Tracing (--trace)
+//
+// Collects spans in memory and writes them as a Chrome Trace Event file
+// at exit, which loads in chrome://tracing and ui.perfetto.dev. When
+// tracing is off `tracer` is NULL and every hook is a single pointer check.
+
+typedef struct {
+    const char *cat;
+    const char *name; // must outlive the tracer
+    double begin_secs;
+    double end_secs;
+    // Optional range of cells in the evaluation order
+    bool has_range;
+    size_t first;
+    size_t last;
+} Trace_Event;
+
+typedef struct {
+    double origin_secs;
+    Trace_Event *items;
+    size_t count;
+    size_t capacity;
+} Tracer;
+
+Tracer *tracer = NULL;
+
+void trace_span(const char *cat, const char *name, double begin_secs, double end_secs)
+{
+    if (tracer->count >= tracer->capacity) {
+        tracer->capacity = tracer->capacity == 0 ? 256 : tracer->capacity * 2;
+        tracer->items = realloc(tracer->items, sizeof(*tracer->items) * tracer->capacity);
+    }
+
+    tracer->items[tracer->count++] = (Trace_Event) {
+        .cat = cat,
+        .name = name,
+        .begin_secs = begin_secs,
+        .end_secs = end_secs,
+    };
+}
+
+void trace_span_range(const char *cat, const char *name, double begin_secs, double end_secs, size_t first, size_t last)
+{
+    trace_span(cat, name, begin_secs, end_secs);
+    Trace_Event *event = &tracer->items[tracer->count - 1];
+    event->has_range = true;
+    event->first = first;
+    event->last = last;
+}
+
+void fprint_json_string(FILE *stream, const char *cstr)
+{
+    fputc('"', stream);
+    for (; *cstr; ++cstr) {
+        unsigned char c = (unsigned char) *cstr;
+        if (c == '"' || c == '\\') {
+            fprintf(stream, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(stream, "\\u%04x", c);
+        } else {
+            fputc(c, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+bool trace_write(const char *file_path)
+{
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: could not write trace %s: %s\n", file_path, strerror(errno));
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"minicel\"}},\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}}");
+    for (size_t i = 0; i < tracer->count; ++i) {
+        const Trace_Event *event = &tracer->items[i];
+        fprintf(f, ",\n{\"name\":");
+        fprint_json_string(f, event->name);
+        fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f",
+                event->cat,
+                (event->begin_secs - tracer->origin_secs) * 1e6,
+                (event->end_secs - event->begin_secs) * 1e6);
+        if (event->has_range) {
+            fprintf(f, ",\"args\":{\"first\":%zu,\"last\":%zu}", event->first, event->last);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "ERROR: could not write trace %s: %s\n", file_path, strerror(errno));
+    }
+    return ok;
+}
+
+void stats_begin(void)
+{
+    if (stats.enabled || tracer) {
+        stats.wall_start = clock_wall_secs();
+        stats.cpu_start = clock_cpu_secs();
+    }
+}
+
+void stats_end(Phase phase)
+{
+    if (stats.enabled || tracer) {
+        double wall_end = clock_wall_secs();
+        stats.wall[phase] += wall_end - stats.wall_start;
+        stats.cpu[phase] += clock_cpu_secs() - stats.cpu_start;
+        if (tracer) {
+            trace_span("phase", phase_names[phase], stats.wall_start, wall_end);
+        }
+    }
+}
+
 typedef struct Expr Expr;
 typedef size_t Expr_Index;
 
@@ -22,6 +231,8 @@ typedef enum {
     EXPR_KIND_CELL,
     EXPR_KIND_BOP,
     EXPR_KIND_UOP,
+    // A cell of another sheet of the workbook, see Workbook
+    EXPR_KIND_SHEET_CELL,
 } Expr_Kind;
 
 typedef enum {
@@ -68,10 +279,10 @@ static const Bop_Def bop_defs[COUNT_BOP_KINDS] = {
     },
 };
 
-const Bop_Def *bop_def_by_token(String_View token)
+const Bop_Def *bop_def_by_char(char c)
 {
     for (Bop_Kind kind = 0; kind < COUNT_BOP_KINDS; ++kind) {
-        if (sv_eq(bop_defs[kind].token, token)) {
+        if (bop_defs[kind].token.data[0] == c) {
             return &bop_defs[kind];
         }
     }
@@ -99,11 +310,18 @@ typedef struct {
     size_t col;
 } Cell_Index;
 
+typedef struct {
+    // Index into the workbook
+    size_t sheet;
+    Cell_Index cell;
+} Expr_Sheet_Cell;
+
 typedef union {
     double number;
     Cell_Index cell;
     Expr_Bop bop;
     Expr_Uop uop;
+    Expr_Sheet_Cell sheet_cell;
 } Expr_As;
 
 struct Expr {
@@ -118,11 +336,36 @@ typedef struct {
     size_t count;
     size_t capacity;
     Expr *items;
+    size_t reallocs;
+    // The items are mapped from a Snapshot, see table_fork()
+    bool mapped;
+
+    // Optional hash-consing of the expressions. Structurally identical
+    // nodes share the same Expr_Index (see expr_buffer_intern()) and the
+    // value of every operator node that is not an error is memoized within
+    // an evaluation pass (see expr_buffer_begin_pass()).
+    bool hashcons;
+    Expr_Index *slots; // Expr_Index + 1 of the interned node, 0 is empty
+    size_t slots_count;
+    size_t slots_capacity;
+    double *memo_values;
+    size_t *memo_passes;
+    size_t pass;
 } Expr_Buffer;
 
+void expr_buffer_grow_memo(Expr_Buffer *eb, size_t old_capacity)
+{
+    eb->memo_values = realloc(eb->memo_values, sizeof(*eb->memo_values) * eb->capacity);
+    eb->memo_passes = realloc(eb->memo_passes, sizeof(*eb->memo_passes) * eb->capacity);
+    memset(eb->memo_passes + old_capacity, 0, sizeof(*eb->memo_passes) * (eb->capacity - old_capacity));
+}
+
+void file_unmap(void *data, size_t size);
+
 Expr_Index expr_buffer_alloc(Expr_Buffer *eb)
 {
     if (eb->count >= eb->capacity) {
+        size_t old_capacity = eb->capacity;
         if (eb->capacity == 0) {
             assert(eb->items == NULL);
             eb->capacity = 128;
@@ -130,7 +373,20 @@ Expr_Index expr_buffer_alloc(Expr_Buffer *eb)
             eb->capacity *= 2;
         }
 
-        eb->items = realloc(eb->items, sizeof(Expr) * eb->capacity);
+        if (eb->mapped) {
+            // Out of the room the snapshot left for the new expressions
+            Expr *items = malloc(sizeof(Expr) * eb->capacity);
+            memcpy(items, eb->items, sizeof(Expr) * old_capacity);
+            file_unmap(eb->items, sizeof(Expr) * old_capacity);
+            eb->items = items;
+            eb->mapped = false;
+        } else {
+            eb->items = realloc(eb->items, sizeof(Expr) * eb->capacity);
+        }
+        eb->reallocs += 1;
+        if (eb->hashcons) {
+            expr_buffer_grow_memo(eb, old_capacity);
+        }
     }
 
     memset(&eb->items[eb->count], 0, sizeof(Expr));
@@ -138,12 +394,162 @@ Expr_Index expr_buffer_alloc(Expr_Buffer *eb)
     return eb->count++;
 }
 
+void expr_buffer_free(Expr_Buffer *eb)
+{
+    if (eb->mapped) {
+        file_unmap(eb->items, sizeof(*eb->items) * eb->capacity);
+    } else {
+        free(eb->items);
+    }
+    free(eb->slots);
+    free(eb->memo_values);
+    free(eb->memo_passes);
+}
+
+// Invalidates all the memoized values
+void expr_buffer_begin_pass(Expr_Buffer *eb)
+{
+    eb->pass += 1;
+}
+
 Expr *expr_buffer_at(Expr_Buffer *eb, Expr_Index index)
 {
     assert(index < eb->count);
     return &eb->items[index];
 }
 
+uint64_t hash_combine(uint64_t hash, uint64_t value)
+{
+    // splitmix64 finalizer
+    hash ^= value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+// The nodes that may report a diagnostic point to their own location in
+// the file, so only the occurrences at the same location are identical
+bool expr_has_location(const Expr *expr)
+{
+    return expr->kind == EXPR_KIND_CELL ||
+           expr->kind == EXPR_KIND_SHEET_CELL ||
+           (expr->kind == EXPR_KIND_BOP && expr->as.bop.kind == BOP_KIND_DIV);
+}
+
+uint64_t expr_hash(const Expr *expr)
+{
+    uint64_t hash = hash_combine(0, expr->kind);
+    if (expr_has_location(expr)) {
+        hash = hash_combine(hash, expr->file_row);
+        hash = hash_combine(hash, expr->file_col);
+    }
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER: {
+        uint64_t bits = 0;
+        memcpy(&bits, &expr->as.number, sizeof(bits));
+        return hash_combine(hash, bits);
+    }
+    case EXPR_KIND_CELL:
+        hash = hash_combine(hash, expr->as.cell.row);
+        return hash_combine(hash, expr->as.cell.col);
+    case EXPR_KIND_BOP:
+        hash = hash_combine(hash, expr->as.bop.kind);
+        hash = hash_combine(hash, expr->as.bop.lhs);
+        return hash_combine(hash, expr->as.bop.rhs);
+    case EXPR_KIND_UOP:
+        hash = hash_combine(hash, expr->as.uop.kind);
+        return hash_combine(hash, expr->as.uop.param);
+    case EXPR_KIND_SHEET_CELL:
+        hash = hash_combine(hash, expr->as.sheet_cell.sheet);
+        hash = hash_combine(hash, expr->as.sheet_cell.cell.row);
+        return hash_combine(hash, expr->as.sheet_cell.cell.col);
+    default:
+        UNREACHABLE("unknown Expression Kind");
+    }
+}
+
+// The children are already interned, so comparing the indices is enough
+bool expr_same(const Expr *a, const Expr *b)
+{
+    if (a->kind != b->kind) {
+        return false;
+    }
+    if (expr_has_location(a) && (a->file_row != b->file_row || a->file_col != b->file_col)) {
+        return false;
+    }
+
+    switch (a->kind) {
+    case EXPR_KIND_NUMBER:
+        // Bitwise, so 0.0 and -0.0 stay different nodes
+        return memcmp(&a->as.number, &b->as.number, sizeof(a->as.number)) == 0;
+    case EXPR_KIND_CELL:
+        return a->as.cell.row == b->as.cell.row && a->as.cell.col == b->as.cell.col;
+    case EXPR_KIND_BOP:
+        return a->as.bop.kind == b->as.bop.kind && a->as.bop.lhs == b->as.bop.lhs && a->as.bop.rhs == b->as.bop.rhs;
+    case EXPR_KIND_UOP:
+        return a->as.uop.kind == b->as.uop.kind && a->as.uop.param == b->as.uop.param;
+    case EXPR_KIND_SHEET_CELL:
+        return a->as.sheet_cell.sheet == b->as.sheet_cell.sheet &&
+               a->as.sheet_cell.cell.row == b->as.sheet_cell.cell.row &&
+               a->as.sheet_cell.cell.col == b->as.sheet_cell.cell.col;
+    default:
+        UNREACHABLE("unknown Expression Kind");
+    }
+}
+
+void expr_buffer_slots_insert(Expr_Buffer *eb, Expr_Index index)
+{
+    size_t mask = eb->slots_capacity - 1;
+    size_t i = expr_hash(&eb->items[index]) & mask;
+    while (eb->slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    eb->slots[i] = index + 1;
+    eb->slots_count += 1;
+}
+
+// `index` must be the last allocated node. If a structurally identical
+// node already exists the new one is dropped and the existing one is
+// returned instead. Does nothing unless hash-consing is enabled. The
+// nodes that report diagnostics are only shared with the ones at the same
+// location, see expr_has_location().
+Expr_Index expr_buffer_intern(Expr_Buffer *eb, Expr_Index index)
+{
+    if (!eb->hashcons) {
+        return index;
+    }
+    assert(index + 1 == eb->count);
+
+    if (eb->slots_count * 2 >= eb->slots_capacity) {
+        Expr_Index *old_slots = eb->slots;
+        size_t old_capacity = eb->slots_capacity;
+        eb->slots_capacity = old_capacity == 0 ? 1024 : old_capacity * 2;
+        eb->slots = calloc(eb->slots_capacity, sizeof(*eb->slots));
+        eb->slots_count = 0;
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_slots[i] != 0) {
+                expr_buffer_slots_insert(eb, old_slots[i] - 1);
+            }
+        }
+        free(old_slots);
+    }
+
+    const Expr *expr = &eb->items[index];
+    size_t mask = eb->slots_capacity - 1;
+    for (size_t i = expr_hash(expr) & mask; eb->slots[i] != 0; i = (i + 1) & mask) {
+        if (expr_same(&eb->items[eb->slots[i] - 1], expr)) {
+            eb->count -= 1;
+            return eb->slots[i] - 1;
+        }
+    }
+
+    expr_buffer_slots_insert(eb, index);
+    return index;
+}
+
 typedef enum {
     DIR_LEFT = 0,
     DIR_RIGHT,
@@ -174,47 +580,371 @@ const char *cell_kind_as_cstr(Cell_Kind kind)
     }
 }
 
+// Most columns are all numbers or all text below the header row. The
+// parser guesses the type of every column from a sample of its first
+// rows, so the cells of the typed columns skip the checks for the other
+// kinds of cells. COUNT_COLUMN_TYPES stands for a column that has no
+// non-empty cells yet. See COLUMN_SAMPLE_ROWS.
 typedef enum {
-    UNEVALUATED = 0,
-    INPROGRESS,
-    EVALUATED,
-} Eval_Status;
+    COLUMN_TYPE_MIXED = 0,
+    COLUMN_TYPE_NUMBER,
+    COLUMN_TYPE_TEXT,
+    COUNT_COLUMN_TYPES,
+} Column_Type;
 
-typedef struct {
-    Expr_Index index;
-    double value;
-} Cell_Expr;
+const char *column_type_as_cstr(Column_Type type)
+{
+    switch (type) {
+    case COLUMN_TYPE_MIXED:
+        return "MIXED";
+    case COLUMN_TYPE_NUMBER:
+        return "NUMBER";
+    case COLUMN_TYPE_TEXT:
+        return "TEXT";
+    case COUNT_COLUMN_TYPES:
+    default:
+        UNREACHABLE("unknown Column Type");
+    }
+}
+
+// Values
+//
+// The value of a cell is NaN-boxed into 8 bytes. Numbers are stored as
+// they are. Everything else is a quiet NaN with a tag in the high bits of
+// the payload:
+//
+//   VALUE_TAG_ERROR  the Error_Kind in the lowest bits
+//   VALUE_TAG_TEXT   a 32-bit index into the text table of the sheet
+//   VALUE_TAG_EMPTY  an empty cell
+//
+// The NaNs produced by the arithmetic itself (0/0, inf-inf) have no tag,
+// so they stay numbers. Arithmetic propagates the payload of a NaN
+// operand, so errors flow into the dependents without any checks on the
+// hot path. Text and empty values never enter the arithmetic, they are
+// turned into #VALUE! first.
+
+typedef enum {
+    ERROR_NONE = 0,
+    ERROR_REF,
+    ERROR_VALUE,
+    ERROR_CYCLE,
+    ERROR_DIV0,
+    ERROR_PARSE,
+    COUNT_ERRORS,
+} Error_Kind;
+
+const char *error_kind_as_cstr(Error_Kind kind)
+{
+    switch (kind) {
+    case ERROR_REF:
+        return "#REF!";
+    case ERROR_VALUE:
+        return "#VALUE!";
+    case ERROR_CYCLE:
+        return "#CYCLE!";
+    case ERROR_DIV0:
+        return "#DIV/0!";
+    case ERROR_PARSE:
+        return "#PARSE!";
+    case ERROR_NONE:
+    case COUNT_ERRORS:
+    default:
+        UNREACHABLE("unknown Error Kind");
+    }
+}
+
+typedef enum {
+    VALUE_NUMBER = 0,
+    VALUE_TEXT,
+    VALUE_ERROR,
+    VALUE_EMPTY,
+} Value_Type;
 
 typedef union {
-    String_View text;
     double number;
-    Cell_Expr expr;
-    Dir clone;
-} Cell_As;
+    uint64_t bits;
+} Value;
+
+static_assert(sizeof(Value) == 8, "Value must stay NaN-boxed into 8 bytes");
+
+#define VALUE_TAG_MASK     0x7FFF000000000000ULL // everything but the sign and the payload
+#define VALUE_TAG_ERROR    0x7FFA000000000000ULL
+#define VALUE_TAG_TEXT     0x7FFB000000000000ULL
+#define VALUE_TAG_EMPTY    0x7FFC000000000000ULL
+#define VALUE_PAYLOAD_MASK 0x0000FFFFFFFFFFFFULL
+
+Value value_number(double number)
+{
+    return (Value) {
+        .number = number
+    };
+}
+
+Value value_error(Error_Kind kind)
+{
+    return (Value) {
+        .bits = VALUE_TAG_ERROR | (uint64_t) kind
+    };
+}
+
+Value value_text(uint32_t index)
+{
+    return (Value) {
+        .bits = VALUE_TAG_TEXT | (uint64_t) index
+    };
+}
+
+Value value_empty(void)
+{
+    return (Value) {
+        .bits = VALUE_TAG_EMPTY
+    };
+}
+
+Value_Type value_type(Value value)
+{
+    switch (value.bits & VALUE_TAG_MASK) {
+    case VALUE_TAG_ERROR:
+        return VALUE_ERROR;
+    case VALUE_TAG_TEXT:
+        return VALUE_TEXT;
+    case VALUE_TAG_EMPTY:
+        return VALUE_EMPTY;
+    default:
+        return VALUE_NUMBER;
+    }
+}
+
+// ERROR_NONE for everything that is not an error value
+Error_Kind value_error_kind(Value value)
+{
+    if ((value.bits & VALUE_TAG_MASK) != VALUE_TAG_ERROR) {
+        return ERROR_NONE;
+    }
+
+    uint64_t kind = value.bits & 0xFF;
+    if (kind == ERROR_NONE || kind >= COUNT_ERRORS) {
+        return ERROR_NONE;
+    }
+    return (Error_Kind) kind;
+}
+
+uint32_t value_text_index(Value value)
+{
+    assert(value_type(value) == VALUE_TEXT);
+    return (uint32_t) (value.bits & VALUE_PAYLOAD_MASK);
+}
+
+double error_number(Error_Kind kind)
+{
+    return value_error(kind).number;
+}
+
+bool number_is_error(double number)
+{
+    return value_error_kind(value_number(number)) != ERROR_NONE;
+}
+
+typedef enum {
+    UNEVALUATED = 0,
+    INPROGRESS,
+    EVALUATED,
+} Eval_Status;
 
 typedef struct {
     Cell_Kind kind;
-    Cell_As as;
     Eval_Status status;
 
-    size_t file_row;
+    // The number of a number cell, the text of a text cell or the result
+    // of an expression cell
+    Value value;
+    // The expression of an expression cell
+    Expr_Index expr;
+
+    // A clone cell becomes its neighbor kind after the evaluation. These
+    // remember where it was cloned from so it can be resolved again when
+    // the neighbor changes.
+    bool cloned;
+    Dir clone_dir;
+    // The offset of the cell a cloned expression cell got its expression
+    // from, see Clone_Site
+    size_t source;
+
+    // The column of the cell in the file, its line is the row plus one
     size_t file_col;
 } Cell;
 
+void cell_set_error(Cell *cell, Error_Kind kind)
+{
+    cell->kind = CELL_KIND_NUMBER;
+    cell->value = value_error(kind);
+}
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Cell_Index *items;
+} Cell_Indices;
+
+void cell_indices_push(Cell_Indices *ci, Cell_Index index)
+{
+    if (ci->count >= ci->capacity) {
+        ci->capacity = ci->capacity == 0 ? 4 : ci->capacity * 2;
+        ci->items = realloc(ci->items, sizeof(*ci->items) * ci->capacity);
+    }
+
+    ci->items[ci->count++] = index;
+}
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    String_View *items;
+    // The items are mapped from a Snapshot, see table_fork()
+    bool mapped;
+} Texts;
+
+typedef struct Profiler Profiler;
+
+// The cycles reported by table_analyze_dependencies(). Every cycle is the
+// amount of its cells followed by their offsets.
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t *items;
+} Cycle_Log;
+
+void cycle_log_push(Cycle_Log *log, size_t item)
+{
+    if (log->count >= log->capacity) {
+        log->capacity = log->capacity == 0 ? 16 : log->capacity * 2;
+        log->items = realloc(log->items, sizeof(*log->items) * log->capacity);
+    }
+    log->items[log->count++] = item;
+}
+
+// Open addressing hash map from the text of the header cells to their
+// columns. It's built on the first lookup and thrown away whenever the
+// header row changes. The slots keep only the columns, the names are
+// compared against the header cells themselves, so they never point
+// into content that is gone.
+typedef struct {
+    size_t *slots; // the column + 1, 0 is empty
+    size_t capacity;
+    bool indexed;
+} Column_Names;
+
+// Marks the slot of a name that several columns have
+#define COLUMN_NAME_AMBIGUOUS ((size_t) 1 << (sizeof(size_t) * 8 - 1))
+
 typedef struct {
     Cell *cells;
     size_t rows;
     size_t cols;
     const char *file_path;
+
+    // The text values index into this. The views point into the content
+    // the table was parsed from.
+    Texts texts;
+
+    // Reverse dependency index for incremental recalculation. Built by
+    // table_build_dependents(), NULL for one-shot evaluation.
+    Cell_Indices *dependents;
+    // Cells changed by table_set_cell() since the last table_recalc()
+    Cell_Indices changed;
+    // Scratch space of table_recalc(). Always cleared back to zeros
+    // after the recalculation, so the cost of it is proportional to the
+    // amount of dirty cells, not the size of the table.
+    bool *dirty;
+    // The node of the dirty cell in the graph of the recalculation plus one
+    size_t *dirty_node;
+    Cell_Indices order;
+    Cell_Indices precedents;
+
+    // When set, table_eval_cell() appends every cell it finishes
+    // evaluating. That is a valid topological order of the table.
+    Cell_Indices *eval_order;
+    // When set, table_analyze_dependencies() appends every cycle it
+    // reports
+    Cycle_Log *cycles;
+
+    // When set, the evaluation records the cost of every cell
+    Profiler *profiler;
+
+    // Only the first `rows` rows of the file are parsed (--head). The
+    // rows below them that the evaluation needs are recorded in
+    // rows_needed instead of being treated as outside of the table.
+    bool partial;
+    size_t rows_needed;
+
+    // The content has `:^*` fills, see parse_table_from_content()
+    bool filled;
+
+    // The types of the columns of the content the table was parsed from,
+    // NULL when it was not parsed (--cache, table_fork())
+    Column_Type *column_types;
+
+    // The columns by the names in their header cells, see
+    // table_find_column()
+    Column_Names names;
+
+    // The cells and the dependents are mapped from a Snapshot, see
+    // table_fork()
+    bool mapped;
 } Table;
 
-bool is_name(char c)
-{
-    return isalnum(c) || c == '_';
-}
+// The lexer of the formulas looks every character up in char_classes
+// once and never scans the same characters twice
+typedef enum {
+    CHAR_CLASS_INVALID = 0,
+    CHAR_CLASS_SPACE,
+    CHAR_CLASS_NAME,
+    CHAR_CLASS_OPERATOR,
+    CHAR_CLASS_OPEN_PAREN,
+    CHAR_CLASS_CLOSE_PAREN,
+    CHAR_CLASS_OPEN_BRACKET,
+    CHAR_CLASS_QUOTE,
+} Char_Class;
+
+#define NAME CHAR_CLASS_NAME
+static const uint8_t char_classes[256] = {
+    [' '] = CHAR_CLASS_SPACE, ['\t'] = CHAR_CLASS_SPACE, ['\n'] = CHAR_CLASS_SPACE,
+    ['\v'] = CHAR_CLASS_SPACE, ['\f'] = CHAR_CLASS_SPACE, ['\r'] = CHAR_CLASS_SPACE,
+    ['+'] = CHAR_CLASS_OPERATOR, ['-'] = CHAR_CLASS_OPERATOR,
+    ['*'] = CHAR_CLASS_OPERATOR, ['/'] = CHAR_CLASS_OPERATOR,
+    ['('] = CHAR_CLASS_OPEN_PAREN, [')'] = CHAR_CLASS_CLOSE_PAREN,
+    ['['] = CHAR_CLASS_OPEN_BRACKET, ['\''] = CHAR_CLASS_QUOTE,
+    ['_'] = NAME, ['.'] = NAME,
+    ['0'] = NAME, ['1'] = NAME, ['2'] = NAME, ['3'] = NAME, ['4'] = NAME,
+    ['5'] = NAME, ['6'] = NAME, ['7'] = NAME, ['8'] = NAME, ['9'] = NAME,
+    ['A'] = NAME, ['B'] = NAME, ['C'] = NAME, ['D'] = NAME, ['E'] = NAME, ['F'] = NAME, ['G'] = NAME,
+    ['H'] = NAME, ['I'] = NAME, ['J'] = NAME, ['K'] = NAME, ['L'] = NAME, ['M'] = NAME, ['N'] = NAME,
+    ['O'] = NAME, ['P'] = NAME, ['Q'] = NAME, ['R'] = NAME, ['S'] = NAME, ['T'] = NAME, ['U'] = NAME,
+    ['V'] = NAME, ['W'] = NAME, ['X'] = NAME, ['Y'] = NAME, ['Z'] = NAME,
+    ['a'] = NAME, ['b'] = NAME, ['c'] = NAME, ['d'] = NAME, ['e'] = NAME, ['f'] = NAME, ['g'] = NAME,
+    ['h'] = NAME, ['i'] = NAME, ['j'] = NAME, ['k'] = NAME, ['l'] = NAME, ['m'] = NAME, ['n'] = NAME,
+    ['o'] = NAME, ['p'] = NAME, ['q'] = NAME, ['r'] = NAME, ['s'] = NAME, ['t'] = NAME, ['u'] = NAME,
+    ['v'] = NAME, ['w'] = NAME, ['x'] = NAME, ['y'] = NAME, ['z'] = NAME,
+};
+#undef NAME
+
+typedef enum {
+    TOKEN_KIND_END = 0,
+    TOKEN_KIND_NAME,
+    TOKEN_KIND_OPERATOR,
+    TOKEN_KIND_OPEN_PAREN,
+    TOKEN_KIND_CLOSE_PAREN,
+    // `[Name]1`, the cell of a named column
+    TOKEN_KIND_NAMED_CELL,
+    // `other.csv!B3` or `'../other.csv'!B3`, a cell of another sheet
+    TOKEN_KIND_SHEET_CELL,
+} Token_Kind;
 
 typedef struct {
+    Token_Kind kind;
     String_View text;
+    // The operator of TOKEN_KIND_OPERATOR
+    const Bop_Def *bop;
     const char *file_path;
     size_t file_row;
     size_t file_col;
@@ -225,76 +955,115 @@ typedef struct {
     const char *file_path;
     size_t file_row;
     const char *line_start;
+    // The token the parser is looking at, consumed by lexer_next()
+    Token token;
+    // Resolves the names of the columns
+    Table *table;
 } Lexer;
 
-size_t lexer_file_col(const Lexer *lexer)
-{
-    return lexer->source.data - lexer->line_start + 1;
-}
-
-void lexer_print_loc(const Lexer *lexer, FILE *stream)
-{
-    fprintf(stream, "%s:%zu:%zu: ",
-            lexer->file_path,
-            lexer->file_row,
-            lexer_file_col(lexer));
-}
-
-Token lexer_peek_token(Lexer *lexer)
+// Scans the token that follows the current one into lexer->token
+bool lexer_next(Lexer *lexer)
 {
-    lexer->source = sv_trim(lexer->source);
-
-    Token token;
-    memset(&token, 0, sizeof(token));
-    token.file_path = lexer->file_path;
-    token.file_row = lexer->file_row;
-    token.file_col = lexer_file_col(lexer);
-
-    if (lexer->source.count == 0) {
-        return token;
-    }
-
-    if (*lexer->source.data == '+' ||
-            *lexer->source.data == '-' ||
-            *lexer->source.data == '*' ||
-            *lexer->source.data == '/' ||
-            *lexer->source.data == '(' ||
-            *lexer->source.data == ')') {
-        token.text = (String_View) {
-            .count = 1,
-            .data = lexer->source.data
-        };
-        return token;
+    const char *p = lexer->source.data;
+    const char *end = p + lexer->source.count;
+    while (p < end && char_classes[(uint8_t) *p] == CHAR_CLASS_SPACE) {
+        p += 1;
     }
 
-    if (is_name(*lexer->source.data)) {
-        token.text = sv_take_left_while(lexer->source, is_name);
-        return token;
-    }
+    Token *token = &lexer->token;
+    token->text.data = p;
+    token->bop = NULL;
+    token->file_path = lexer->file_path;
+    token->file_row = lexer->file_row;
+    token->file_col = p - lexer->line_start + 1;
 
-    lexer_print_loc(lexer, stderr);
-    fprintf(stderr, "ERROR: unknown token starts with `%c`\n", *lexer->source.data);
-    exit(1);
-}
+    if (p == end) {
+        token->kind = TOKEN_KIND_END;
+    } else {
+        switch ((Char_Class) char_classes[(uint8_t) *p]) {
+        case CHAR_CLASS_NAME:
+            token->kind = TOKEN_KIND_NAME;
+            while (p < end && char_classes[(uint8_t) *p] == CHAR_CLASS_NAME) {
+                p += 1;
+            }
+            if (p < end && *p == '!') {
+                token->kind = TOKEN_KIND_SHEET_CELL;
+                p += 1;
+                while (p < end && char_classes[(uint8_t) *p] == CHAR_CLASS_NAME) {
+                    p += 1;
+                }
+            }
+            break;
+        case CHAR_CLASS_QUOTE: {
+            const char *close = memchr(p + 1, '\'', end - p - 1);
+            if (close == NULL || close + 1 >= end || close[1] != '!') {
+                fprintf(stderr, "%s:%zu:%zu: ERROR: quoted sheet path must be followed by `!` and a cell\n",
+                        token->file_path, token->file_row, token->file_col);
+                return false;
+            }
+            token->kind = TOKEN_KIND_SHEET_CELL;
+            p = close + 2;
+            while (p < end && char_classes[(uint8_t) *p] == CHAR_CLASS_NAME) {
+                p += 1;
+            }
+        } break;
+        case CHAR_CLASS_OPERATOR:
+            token->kind = TOKEN_KIND_OPERATOR;
+            token->bop = bop_def_by_char(*p);
+            assert(token->bop != NULL);
+            p += 1;
+            break;
+        case CHAR_CLASS_OPEN_PAREN:
+            token->kind = TOKEN_KIND_OPEN_PAREN;
+            p += 1;
+            break;
+        case CHAR_CLASS_CLOSE_PAREN:
+            token->kind = TOKEN_KIND_CLOSE_PAREN;
+            p += 1;
+            break;
+        case CHAR_CLASS_OPEN_BRACKET: {
+            // The name may have anything but `]` in it, the row follows
+            // right after it
+            const char *close = memchr(p, ']', end - p);
+            if (close == NULL) {
+                fprintf(stderr, "%s:%zu:%zu: ERROR: column name is missing the closing `]`\n",
+                        token->file_path, token->file_row, token->file_col);
+                return false;
+            }
+            token->kind = TOKEN_KIND_NAMED_CELL;
+            p = close + 1;
+            while (p < end && char_classes[(uint8_t) *p] == CHAR_CLASS_NAME) {
+                p += 1;
+            }
+        } break;
+        case CHAR_CLASS_SPACE:
+        case CHAR_CLASS_INVALID:
+        default:
+            fprintf(stderr, "%s:%zu:%zu: ERROR: unknown token starts with `%c`\n",
+                    token->file_path, token->file_row, token->file_col, *p);
+            return false;
+        }
+    }
 
-Token lexer_next_token(Lexer *lexer)
-{
-    Token token = lexer_peek_token(lexer);
-    sv_chop_left(&lexer->source, token.text.count);
-    return token;
+    token->text.count = p - token->text.data;
+    lexer->source.count = end - p;
+    lexer->source.data = p;
+    return true;
 }
 
-void lexer_expect_no_tokens(Lexer *lexer)
+bool lexer_expect_no_tokens(Lexer *lexer)
 {
-    Token token = lexer_next_token(lexer);
-    if (token.text.data != NULL) {
+    Token token = lexer->token;
+    if (token.kind != TOKEN_KIND_END) {
         fprintf(stderr, "%s:%zu:%zu: ERROR: unexpected token `"SV_Fmt"`\n",
                 token.file_path,
                 token.file_row,
                 token.file_col,
                 SV_Arg(token.text));
-        exit(1);
+        return false;
     }
+
+    return true;
 }
 
 typedef struct {
@@ -319,6 +1088,8 @@ bool sv_strtod(String_View sv, Tmp_Cstr *tc, double *out)
     char *ptr = tmp_cstr_fill(tc, sv.data, sv.count);
     char *endptr = NULL;
     double result = strtod(ptr, &endptr);
+    // `nan(...)` may carry any payload, including the tags of the values
+    if (result != result) result = NAN;
     if (out) *out = result;
     return endptr != ptr && *endptr == '\0';
 }
@@ -332,110 +1103,459 @@ bool sv_strtol(String_View sv, Tmp_Cstr *tc, long int *out)
     return endptr != ptr && *endptr == '\0';
 }
 
-Expr_Index parse_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb);
+uint64_t fnv1a(String_View sv)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sv.count; ++i) {
+        hash ^= (uint8_t) sv.data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-Expr_Index parse_primary_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb)
+// Parses cell references like `A1`: a capital letter for the column
+// followed by the row number
+bool parse_cell_index(String_View text, Tmp_Cstr *tc, Cell_Index *out)
 {
-    Token token = lexer_next_token(lexer);
+    if (text.count == 0 || !isupper(*text.data)) {
+        return false;
+    }
 
-    if (token.text.count == 0) {
-        lexer_print_loc(lexer, stderr);
-        fprintf(stderr, "ERROR: expected primary expression token, but got end of input\n");
-        exit(1);
+    out->col = *text.data - 'A';
+    sv_chop_left(&text, 1);
+
+    long int row = 0;
+    if (!sv_strtol(text, tc, &row) || row < 0) {
+        return false;
     }
 
-    double number = 0.0;
-    if (sv_strtod(token.text, tc, &number)) {
-        Expr_Index expr_index = expr_buffer_alloc(eb);
-        Expr *expr = expr_buffer_at(eb, expr_index);
-        expr->kind = EXPR_KIND_NUMBER;
-        expr->as.number = number;
-        expr->file_path = token.file_path;
-        expr->file_row  = token.file_row;
-        expr->file_col  = token.file_col;
-        return expr_index;
-    } else if (sv_eq(token.text, SV("("))) {
-        Expr_Index expr_index = parse_expr(lexer, tc, eb);
-        token = lexer_next_token(lexer);
-        if (!sv_eq(token.text, SV(")"))) {
-            fprintf(stderr, "%s:%zu:%zu: Expected token `)` but got `"SV_Fmt"`\n", token.file_path, token.file_row, token.file_col, SV_Arg(token.text));
-            exit(1);
+    out->row = (size_t) row;
+    return true;
+}
+
+// Workbooks
+//
+// `=other.csv!B3` refers to the cell B3 of the sheet in other.csv. The
+// path is relative to the directory of the sheet the formula is in. The
+// paths with characters other than letters, digits, `_` and `.` go in
+// quotes: `='../data/other.csv'!B3`.
+//
+// The parser only registers the sheet. The first evaluation of a
+// reference to it maps, parses and evaluates the sheet, see
+// workbook_load(). Every other reference in the run reads the values of
+// that single copy, so each sheet is evaluated at most once. The sheet of
+// the run is registered first, see workbook_add_root(), so the other
+// sheets refer back to it instead of to a copy.
+//
+// The sheets that refer to each other are evaluated cell by cell: a
+// reference to a sheet that is not completely evaluated yet evaluates
+// just the referenced cell and the cells it depends on. Only a reference
+// back to a cell that is still being evaluated is a cycle.
+
+typedef enum {
+    BOOK_SHEET_UNLOADED = 0,
+    // Parsed but not completely evaluated, on the stack of
+    // workbook_load() or the sheet of the run. Its cells are evaluated on
+    // demand.
+    BOOK_SHEET_LOADING,
+    BOOK_SHEET_EVALUATED,
+    // Could not be read
+    BOOK_SHEET_FAILED,
+} Book_Sheet_Status;
+
+typedef struct {
+    char *file_path;
+    Book_Sheet_Status status;
+    char *content;
+    size_t content_size;
+    bool mapped;
+    // Owned by the caller of workbook_add_root() for the sheet of the run
+    bool root;
+    Table *table;
+    Expr_Buffer *eb;
+} Book_Sheet;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    // Pointers, so the tables stay put while the parser of one of them
+    // adds more sheets
+    Book_Sheet **items;
+    // Open addressing hash map from the paths of the sheets to their
+    // indices + 1, 0 is empty
+    size_t *slots;
+    size_t slots_capacity;
+    Tmp_Cstr tc;
+    Tmp_Cstr path;
+    // The cells being evaluated on demand, see WORKBOOK_MAX_DEPTH
+    size_t depth;
+    // The mode that keeps the sheets resident. It could not tell when the
+    // other sheets change, so the references to them don't parse.
+    const char *resident;
+} Workbook;
+
+static Workbook workbook = {0};
+
+// The sheets are told apart by their paths as they are written, so the
+// different paths to the same file load it more than once. The size of
+// the directory of `referrer` that the `path` is relative to.
+size_t workbook_dir_size(const char *referrer, String_View path)
+{
+    size_t dir_size = 0;
+    if (!sv_starts_with(path, SV("/"))) {
+        for (size_t i = 0; referrer[i] != '\0'; ++i) {
+            if (referrer[i] == '/' || referrer[i] == '\\') {
+                dir_size = i + 1;
+            }
         }
-        return expr_index;
-    } else if (sv_eq(token.text, SV("-"))) {
-        Expr_Index param_index = parse_expr(lexer, tc, eb);
-        Expr_Index expr_index = expr_buffer_alloc(eb);
-        {
-            Expr *expr = expr_buffer_at(eb, expr_index);
-            expr->kind = EXPR_KIND_UOP;
-            expr->as.uop.kind = UOP_KIND_MINUS;
-            expr->as.uop.param = param_index;
-            expr->file_path = token.file_path;
-            expr->file_row  = token.file_row;
-            expr->file_col  = token.file_col;
-        }
-        return expr_index;
-    } else {
-        Expr_Index expr_index = expr_buffer_alloc(eb);
-        Expr *expr = expr_buffer_at(eb, expr_index);
-        expr->file_path = token.file_path;
-        expr->file_row  = token.file_row;
-        expr->file_col  = token.file_col;
-        expr->kind = EXPR_KIND_CELL;
+    }
+    return dir_size;
+}
 
-        if (!isupper(*token.text.data)) {
-            lexer_print_loc(lexer, stderr);
-            fprintf(stderr, "ERROR: cell reference must start with capital letter\n");
-            exit(1);
+// Whether the `file_path` is the `path` relative to the directory of
+// `referrer`
+bool workbook_path_eq(const char *file_path, const char *referrer, String_View path)
+{
+    size_t dir_size = workbook_dir_size(referrer, path);
+    return strlen(file_path) == dir_size + path.count &&
+           memcmp(file_path, referrer, dir_size) == 0 &&
+           memcmp(file_path + dir_size, path.data, path.count) == 0;
+}
+
+void workbook_index_paths(size_t capacity)
+{
+    free(workbook.slots);
+    workbook.slots = calloc(capacity, sizeof(*workbook.slots));
+    workbook.slots_capacity = capacity;
+
+    size_t mask = capacity - 1;
+    for (size_t sheet = 0; sheet < workbook.count; ++sheet) {
+        size_t i = fnv1a(sv_from_cstr(workbook.items[sheet]->file_path)) & mask;
+        while (workbook.slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        workbook.slots[i] = sheet + 1;
+    }
+}
+
+// Returns the index of the sheet at the `path` relative to the directory
+// of the `referrer` sheet, registering it on its first reference
+size_t workbook_add(const char *referrer, String_View path)
+{
+    size_t dir_size = workbook_dir_size(referrer, path);
+    size_t size = dir_size + path.count;
+    if (size + 1 > workbook.path.capacity) {
+        workbook.path.capacity = size + 1;
+        workbook.path.cstr = realloc(workbook.path.cstr, workbook.path.capacity);
+    }
+    char *file_path = workbook.path.cstr;
+    memcpy(file_path, referrer, dir_size);
+    memcpy(file_path + dir_size, path.data, path.count);
+    file_path[size] = '\0';
+
+    if (workbook.slots_capacity < (workbook.count + 1) * 2) {
+        workbook_index_paths(workbook.slots_capacity == 0 ? 16 : workbook.slots_capacity * 2);
+    }
+
+    size_t mask = workbook.slots_capacity - 1;
+    size_t i = fnv1a(sv_from_cstr(file_path)) & mask;
+    for (; workbook.slots[i] != 0; i = (i + 1) & mask) {
+        if (strcmp(workbook.items[workbook.slots[i] - 1]->file_path, file_path) == 0) {
+            return workbook.slots[i] - 1;
         }
+    }
+
+    Book_Sheet *sheet = calloc(1, sizeof(*sheet));
+    sheet->file_path = malloc(size + 1);
+    memcpy(sheet->file_path, file_path, size + 1);
+    sheet->table = calloc(1, sizeof(*sheet->table));
+    sheet->eb = calloc(1, sizeof(*sheet->eb));
 
-        expr->as.cell.col = *token.text.data - 'A';
+    if (workbook.count >= workbook.capacity) {
+        workbook.capacity = workbook.capacity == 0 ? 4 : workbook.capacity * 2;
+        workbook.items = realloc(workbook.items, sizeof(*workbook.items) * workbook.capacity);
+    }
+    workbook.items[workbook.count] = sheet;
+    workbook.slots[i] = workbook.count + 1;
+    return workbook.count++;
+}
+
+// Registers the sheet of the run before it is parsed. The references to
+// it from the other sheets evaluate the cells of `table` on demand.
+void workbook_add_root(Table *table, Expr_Buffer *eb)
+{
+    assert(workbook.count == 0);
+    size_t index = workbook_add("", sv_from_cstr(table->file_path));
+    Book_Sheet *sheet = workbook.items[index];
+    free(sheet->table);
+    free(sheet->eb);
+    sheet->root = true;
+    sheet->status = BOOK_SHEET_LOADING;
+    sheet->table = table;
+    sheet->eb = eb;
+}
 
-        sv_chop_left(&token.text, 1);
+bool parse_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb, Expr_Index *out);
+bool table_find_column(Table *table, String_View name, size_t *col, bool *ambiguous);
 
-        long int row = 0;
-        if (!sv_strtol(token.text, tc, &row)) {
-            lexer_print_loc(lexer, stderr);
-            fprintf(stderr, "ERROR: cell reference must have an integer as the row number\n");
-            exit(1);
+Expr_Index parse_push_expr(Expr_Buffer *eb, const Token *token, Expr_Kind kind, Expr_As as)
+{
+    Expr_Index expr_index = expr_buffer_alloc(eb);
+    Expr *expr = expr_buffer_at(eb, expr_index);
+    expr->kind = kind;
+    expr->as = as;
+    expr->file_path = token->file_path;
+    expr->file_row  = token->file_row;
+    expr->file_col  = token->file_col;
+    return expr_buffer_intern(eb, expr_index);
+}
+
+// Accumulates up to `max_digits` decimal digits. Anything else is left
+// to the general parsers.
+bool parse_digits(String_View text, size_t max_digits, uint64_t *out)
+{
+    if (text.count == 0 || text.count > max_digits) {
+        return false;
+    }
+
+    uint64_t result = 0;
+    for (size_t i = 0; i < text.count; ++i) {
+        if (text.data[i] < '0' || text.data[i] > '9') {
+            return false;
         }
+        result = result * 10 + (uint64_t) (text.data[i] - '0');
+    }
+    *out = result;
+    return true;
+}
+
+// Decimal numbers like `-12.50` with at most 15 digits are an integer
+// and a power of ten that are both exact doubles. The division of the
+// two rounds the same way strtod() does, without copying the text into
+// a C string. Exponents, hex, `inf` and `nan` are left to strtod().
+bool parse_decimal(String_View text, double *out)
+{
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    };
+
+    const char *p = text.data;
+    const char *end = p + text.count;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p += 1;
+    }
 
-        expr->as.cell.row = (size_t) row;
-        return expr_index;
+    uint64_t mantissa = 0;
+    size_t digits = 0;
+    size_t decimals = 0;
+    bool point = false;
+    for (; p < end; ++p) {
+        if (*p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+            digits += 1;
+            decimals += point;
+        } else if (*p == '.' && !point) {
+            point = true;
+        } else {
+            return false;
+        }
     }
+    if (digits == 0 || digits > 15) {
+        return false;
+    }
+
+    double number = (double) mantissa / powers_of_ten[decimals];
+    *out = negative ? -number : number;
+    return true;
 }
 
-Expr_Index parse_bop_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb, size_t precedence)
+bool parse_primary_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb, Expr_Index *out)
 {
-    if (precedence >= COUNT_BOP_PRECEDENCE) {
-        return parse_primary_expr(lexer, tc, eb);
+    Token token = lexer->token;
+
+    switch (token.kind) {
+    case TOKEN_KIND_END:
+        fprintf(stderr, "%s:%zu:%zu: ERROR: expected primary expression token, but got end of input\n",
+                token.file_path, token.file_row, token.file_col);
+        return false;
+
+    case TOKEN_KIND_OPEN_PAREN:
+        if (!lexer_next(lexer) || !parse_expr(lexer, tc, eb, out)) {
+            return false;
+        }
+        token = lexer->token;
+        if (token.kind != TOKEN_KIND_CLOSE_PAREN) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: expected token `)` but got `"SV_Fmt"`\n",
+                    token.file_path, token.file_row, token.file_col, SV_Arg(token.text));
+            return false;
+        }
+        return lexer_next(lexer);
+
+    case TOKEN_KIND_OPERATOR: {
+        if (token.bop->kind != BOP_KIND_MINUS) {
+            break;
+        }
+
+        // The unary minus binds tighter than any binary operator
+        Expr_As as = {0};
+        as.uop.kind = UOP_KIND_MINUS;
+        if (!lexer_next(lexer) || !parse_primary_expr(lexer, tc, eb, &as.uop.param)) {
+            return false;
+        }
+        *out = parse_push_expr(eb, &token, EXPR_KIND_UOP, as);
+        return true;
+    }
+
+    case TOKEN_KIND_NAME: {
+        if (!lexer_next(lexer)) {
+            return false;
+        }
+
+        // Plain integers and cell references are by far the most common
+        // names, they don't need strtod() and strtol(). A capital letter
+        // followed by digits is never a number for strtod().
+        Expr_As as = {0};
+        uint64_t digits = 0;
+        if (parse_digits(token.text, 15, &digits)) {
+            as.number = (double) digits;
+            *out = parse_push_expr(eb, &token, EXPR_KIND_NUMBER, as);
+            return true;
+        }
+        String_View row = token.text;
+        sv_chop_left(&row, 1);
+        if (isupper(*token.text.data) && parse_digits(row, 18, &digits)) {
+            as.cell.col = *token.text.data - 'A';
+            as.cell.row = (size_t) digits;
+            *out = parse_push_expr(eb, &token, EXPR_KIND_CELL, as);
+            return true;
+        }
+
+        if (sv_strtod(token.text, tc, &as.number)) {
+            *out = parse_push_expr(eb, &token, EXPR_KIND_NUMBER, as);
+            return true;
+        }
+
+        if (!isupper(*token.text.data)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: cell reference must start with capital letter\n",
+                    token.file_path, token.file_row, token.file_col);
+            return false;
+        }
+
+        if (!parse_cell_index(token.text, tc, &as.cell)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: cell reference must have an integer as the row number\n",
+                    token.file_path, token.file_row, token.file_col);
+            return false;
+        }
+
+        *out = parse_push_expr(eb, &token, EXPR_KIND_CELL, as);
+        return true;
+    }
+
+    case TOKEN_KIND_NAMED_CELL: {
+        if (!lexer_next(lexer)) {
+            return false;
+        }
+
+        String_View row = token.text;
+        sv_chop_left(&row, 1);
+        String_View name = sv_trim(sv_chop_by_delim(&row, ']'));
+        uint64_t digits = 0;
+        if (!parse_digits(row, 18, &digits)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: cell reference must have an integer as the row number\n",
+                    token.file_path, token.file_row, token.file_col);
+            return false;
+        }
+
+        Expr_As as = {0};
+        bool ambiguous = false;
+        if (!table_find_column(lexer->table, name, &as.cell.col, &ambiguous)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: %s column named `"SV_Fmt"` in the header row\n",
+                    token.file_path, token.file_row, token.file_col,
+                    ambiguous ? "more than one" : "no", SV_Arg(name));
+            return false;
+        }
+        as.cell.row = (size_t) digits;
+        *out = parse_push_expr(eb, &token, EXPR_KIND_CELL, as);
+        return true;
     }
 
-    Expr_Index lhs_index = parse_bop_expr(lexer, tc, eb, precedence + 1);
+    case TOKEN_KIND_SHEET_CELL: {
+        if (!lexer_next(lexer)) {
+            return false;
+        }
 
-    Token token = lexer_peek_token(lexer);
-    const Bop_Def *def = bop_def_by_token(token.text);
+        String_View cell = token.text;
+        String_View path = {0};
+        if (sv_starts_with(cell, SV("'"))) {
+            sv_chop_left(&cell, 1);
+            path = sv_chop_by_delim(&cell, '\'');
+            sv_chop_left(&cell, 1);
+        } else {
+            path = sv_chop_by_delim(&cell, '!');
+        }
 
-    if (def != NULL && def->precedence == precedence) {
-        token = lexer_next_token(lexer);
-        Expr_Index rhs_index = parse_bop_expr(lexer, tc, eb, precedence);
+        Expr_As as = {0};
+        if (cell.count == 0 || !isupper(*cell.data) || !parse_cell_index(cell, tc, &as.sheet_cell.cell)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: expected a cell of the sheet "SV_Fmt" after `!`\n",
+                    token.file_path, token.file_row, token.file_col, SV_Arg(path));
+            return false;
+        }
+        // A sheet referring to its own cells by its path needs no second
+        // copy of itself
+        if (workbook_path_eq(token.file_path, token.file_path, path)) {
+            Cell_Index cell_index = as.sheet_cell.cell;
+            as.cell = cell_index;
+            *out = parse_push_expr(eb, &token, EXPR_KIND_CELL, as);
+            return true;
+        }
 
-        Expr_Index expr_index = expr_buffer_alloc(eb);
-        {
-            Expr *expr = expr_buffer_at(eb, expr_index);
-            expr->kind = EXPR_KIND_BOP;
-            expr->as.bop.kind = def->kind;
-            expr->as.bop.lhs = lhs_index;
-            expr->as.bop.rhs = rhs_index;
-            expr->file_path = token.file_path;
-            expr->file_row = token.file_row;
-            expr->file_col = token.file_col;
+        if (workbook.resident != NULL) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: references to other sheets are not supported with %s\n",
+                    token.file_path, token.file_row, token.file_col, workbook.resident);
+            return false;
         }
+        as.sheet_cell.sheet = workbook_add(token.file_path, path);
+        *out = parse_push_expr(eb, &token, EXPR_KIND_SHEET_CELL, as);
+        return true;
+    }
+
+    case TOKEN_KIND_CLOSE_PAREN:
+    default:
+        break;
+    }
 
-        return expr_index;
+    fprintf(stderr, "%s:%zu:%zu: ERROR: expected primary expression, but got `"SV_Fmt"`\n",
+            token.file_path, token.file_row, token.file_col, SV_Arg(token.text));
+    return false;
+}
+
+// Precedence climbing: parses the operand, then folds every following
+// operator of at least `precedence` into it. The right operand only takes
+// the operators that bind tighter, so the operators of the same
+// precedence associate to the left.
+bool parse_bop_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb, size_t precedence, Expr_Index *out)
+{
+    Expr_Index lhs_index = 0;
+    if (!parse_primary_expr(lexer, tc, eb, &lhs_index)) {
+        return false;
+    }
+
+    while (lexer->token.kind == TOKEN_KIND_OPERATOR && lexer->token.bop->precedence >= precedence) {
+        Token token = lexer->token;
+        Expr_As as = {0};
+        as.bop.kind = token.bop->kind;
+        as.bop.lhs = lhs_index;
+        if (!lexer_next(lexer) || !parse_bop_expr(lexer, tc, eb, token.bop->precedence + 1, &as.bop.rhs)) {
+            return false;
+        }
+        lhs_index = parse_push_expr(eb, &token, EXPR_KIND_BOP, as);
     }
 
-    return lhs_index;
+    *out = lhs_index;
+    return true;
 }
 
 Cell *table_cell_at(Table *table, Cell_Index index)
@@ -445,6 +1565,104 @@ Cell *table_cell_at(Table *table, Cell_Index index)
     return &table->cells[index.row * table->cols + index.col];
 }
 
+Value table_push_text(Table *table, String_View text)
+{
+    if (text.count == 0) {
+        return value_empty();
+    }
+
+    Texts *texts = &table->texts;
+    assert(texts->count < UINT32_MAX);
+    if (texts->count >= texts->capacity) {
+        size_t old_capacity = texts->capacity;
+        texts->capacity = texts->capacity == 0 ? 256 : texts->capacity * 2;
+        if (texts->mapped) {
+            String_View *items = malloc(sizeof(*items) * texts->capacity);
+            memcpy(items, texts->items, sizeof(*items) * old_capacity);
+            file_unmap(texts->items, sizeof(*items) * old_capacity);
+            texts->items = items;
+            texts->mapped = false;
+        } else {
+            texts->items = realloc(texts->items, sizeof(*texts->items) * texts->capacity);
+        }
+    }
+    texts->items[texts->count] = text;
+    return value_text((uint32_t) texts->count++);
+}
+
+String_View table_text(const Table *table, Value value)
+{
+    uint32_t index = value_text_index(value);
+    assert(index < table->texts.count);
+    return table->texts.items[index];
+}
+
+// The name of the column is the text of its header cell, empty for the
+// other kinds of cells
+String_View table_column_name(Table *table, size_t col)
+{
+    Cell_Index cell_index = {
+        .row = 0,
+        .col = col,
+    };
+    Cell *cell = table_cell_at(table, cell_index);
+    if (cell->cloned || cell->kind != CELL_KIND_TEXT || value_type(cell->value) != VALUE_TEXT) {
+        return SV_NULL;
+    }
+    return table_text(table, cell->value);
+}
+
+void table_index_column_names(Table *table)
+{
+    Column_Names *names = &table->names;
+    names->capacity = 16;
+    while (names->capacity < table->cols * 2) {
+        names->capacity *= 2;
+    }
+    free(names->slots);
+    names->slots = calloc(names->capacity, sizeof(*names->slots));
+    names->indexed = true;
+
+    size_t mask = names->capacity - 1;
+    for (size_t col = 0; table->rows > 0 && col < table->cols; ++col) {
+        String_View name = table_column_name(table, col);
+        if (name.count == 0) {
+            continue;
+        }
+
+        size_t i = fnv1a(name) & mask;
+        while (names->slots[i] != 0 && !sv_eq(table_column_name(table, (names->slots[i] - 1) & ~COLUMN_NAME_AMBIGUOUS), name)) {
+            i = (i + 1) & mask;
+        }
+        names->slots[i] = names->slots[i] == 0 ? col + 1 : names->slots[i] | COLUMN_NAME_AMBIGUOUS;
+    }
+}
+
+// Looks up the column with the `name` in its header cell. Fails for the
+// names that no column or several columns have, telling which one.
+bool table_find_column(Table *table, String_View name, size_t *col, bool *ambiguous)
+{
+    Column_Names *names = &table->names;
+    if (!names->indexed) {
+        table_index_column_names(table);
+    }
+
+    size_t mask = names->capacity - 1;
+    for (size_t i = fnv1a(name) & mask; names->slots[i] != 0; i = (i + 1) & mask) {
+        size_t slot = names->slots[i];
+        if (sv_eq(table_column_name(table, (slot - 1) & ~COLUMN_NAME_AMBIGUOUS), name)) {
+            if (slot & COLUMN_NAME_AMBIGUOUS) {
+                *ambiguous = true;
+                return false;
+            }
+            *col = slot - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void dump_table(FILE *stream, Table *table)
 {
     for (size_t row = 0; row < table->rows; ++row) {
@@ -455,11 +1673,29 @@ void dump_table(FILE *stream, Table *table)
             };
             Cell *cell = table_cell_at(table, cell_index);
 
-            fprintf(stream, "%s:%zu:%zu: %s\n", table->file_path, cell->file_row, cell->file_col, cell_kind_as_cstr(cell->kind));
+            fprintf(stream, "%s:%zu:%zu: %s\n", table->file_path, row + 1, cell->file_col, cell_kind_as_cstr(cell->kind));
         }
     }
 }
 
+const char *expr_kind_as_cstr(Expr_Kind kind)
+{
+    switch (kind) {
+    case EXPR_KIND_NUMBER:
+        return "NUMBER";
+    case EXPR_KIND_CELL:
+        return "CELL";
+    case EXPR_KIND_BOP:
+        return "BOP";
+    case EXPR_KIND_UOP:
+        return "UOP";
+    case EXPR_KIND_SHEET_CELL:
+        return "SHEET_CELL";
+    default:
+        UNREACHABLE("unknown Expression Kind");
+    }
+}
+
 void dump_expr(FILE *stream, Expr_Buffer *eb, Expr_Index expr_index, int level)
 {
     fprintf(stream, "%*s", level * 2, "");
@@ -475,6 +1711,10 @@ void dump_expr(FILE *stream, Expr_Buffer *eb, Expr_Index expr_index, int level)
         fprintf(stream, "CELL(%zu, %zu)\n", expr->as.cell.row, expr->as.cell.col);
         break;
 
+    case EXPR_KIND_SHEET_CELL:
+        fprintf(stream, "SHEET_CELL(%zu, %zu, %zu)\n", expr->as.sheet_cell.sheet, expr->as.sheet_cell.cell.row, expr->as.sheet_cell.cell.col);
+        break;
+
     case EXPR_KIND_UOP:
         switch (expr->as.uop.kind) {
         case UOP_KIND_MINUS:
@@ -519,14 +1759,31 @@ void dump_expr(FILE *stream, Expr_Buffer *eb, Expr_Index expr_index, int level)
     }
 }
 
-Expr_Index parse_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb)
+bool parse_expr(Lexer *lexer, Tmp_Cstr *tc, Expr_Buffer *eb, Expr_Index *out)
 {
-    return parse_bop_expr(lexer, tc, eb, BOP_PRECEDENCE0);
+    return parse_bop_expr(lexer, tc, eb, BOP_PRECEDENCE0, out);
 }
 
 void usage(FILE *stream)
 {
-    fprintf(stream, "Usage: ./minicel <input.csv>\n");
+    fprintf(stream, "Usage: ./minicel [OPTIONS] <input.csv>\n");
+    fprintf(stream, "       ./minicel --serve <socket>\n");
+    fprintf(stream, "       ./minicel --watch <input.csv>\n");
+    fprintf(stream, "OPTIONS:\n");
+    fprintf(stream, "    --fast-math       Allow optimizations that are not exact for -0.0, NaN and infinity\n");
+    fprintf(stream, "    --profile <N>     Report the N cells that take the most time to evaluate to stderr\n");
+    fprintf(stream, "    --trace <file>    Write a Chrome Trace Event timeline of the run to <file>\n");
+    fprintf(stream, "    --stats           Report the time of every phase and the sizes of the table to stderr\n");
+    fprintf(stream, "    --stats-json      Same as --stats but as a single line of JSON\n");
+    fprintf(stream, "    --reassociate     Evaluate long + and * chains as balanced trees\n");
+    fprintf(stream, "    --hashcons        Share structurally identical expressions and evaluate them once\n");
+    fprintf(stream, "    --cache <file>    Reuse the parsed table stored in <file> if it matches the input, store it there otherwise\n");
+    fprintf(stream, "    --rows <list>     Output only these rows, e.g. `1,5:10`\n");
+    fprintf(stream, "    --columns <list>  Output only these columns, e.g. `A,C:E`\n");
+    fprintf(stream, "    --cells <list>    Output only these cells as `<cell>|<value>` lines, e.g. `A1,B2:C3`\n");
+    fprintf(stream, "    --head <N>        Output only the first N rows, parsing as little of the file as they need\n");
+    fprintf(stream, "    --sweep <file>    Output the table once for every scenario of input values in <file>\n");
+    fprintf(stream, "    --parse-only      Only parse the table and report the cells that don't parse\n");
 }
 
 char *slurp_file(const char *file_path, size_t *size)
@@ -583,57 +1840,240 @@ error:
     return NULL;
 }
 
-void parse_table_from_content(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, String_View content)
+bool parse_cell_from_content(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, Cell *cell, size_t file_row, String_View cell_value, const char *line_start)
+{
+    cell->cloned = false;
+
+    if (sv_starts_with(cell_value, SV("="))) {
+        sv_chop_left(&cell_value, 1);
+        cell->kind = CELL_KIND_EXPR;
+        Lexer lexer = {
+            .source = cell_value,
+            .file_path = table->file_path,
+            .file_row = file_row,
+            .line_start = line_start,
+            .table = table,
+        };
+        if (!lexer_next(&lexer) || !parse_expr(&lexer, tc, eb, &cell->expr)) {
+            return false;
+        }
+        if (!lexer_expect_no_tokens(&lexer)) {
+            return false;
+        }
+    } else if (sv_starts_with(cell_value, SV(":"))) {
+        sv_chop_left(&cell_value, 1);
+        cell->kind = CELL_KIND_CLONE;
+        if (sv_eq(cell_value, SV("<"))) {
+            cell->clone_dir = DIR_LEFT;
+        } else if (sv_eq(cell_value, SV(">"))) {
+            cell->clone_dir = DIR_RIGHT;
+        } else if (sv_eq(cell_value, SV("^")) || sv_eq(cell_value, SV("^*"))) {
+            cell->clone_dir = DIR_UP;
+        } else if (sv_eq(cell_value, SV("v"))) {
+            cell->clone_dir = DIR_DOWN;
+        } else {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: "SV_Fmt" is not a correct direction to clone a cell from\n", table->file_path, file_row, cell->file_col, SV_Arg(cell_value));
+            return false;
+        }
+        cell->cloned = true;
+    } else {
+        double number = 0.0;
+        if (parse_decimal(cell_value, &number) || sv_strtod(cell_value, tc, &number)) {
+            cell->kind = CELL_KIND_NUMBER;
+            cell->value = value_number(number);
+        } else {
+            cell->kind = CELL_KIND_TEXT;
+            cell->value = table_push_text(table, cell_value);
+        }
+    }
+
+    return true;
+}
+
+bool sv_starts_with_nocase(String_View sv, const char *prefix)
+{
+    size_t n = strlen(prefix);
+    if (sv.count < n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (tolower((unsigned char) sv.data[i]) != prefix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A non-empty cell that is neither an expression, a clone nor anything
+// strtod() could take for a number
+bool is_plain_text(String_View cell_value)
+{
+    char c = *cell_value.data;
+    if ((c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.' || c == '=' || c == ':') {
+        return false;
+    }
+    if (c == 'i' || c == 'I' || c == 'n' || c == 'N') {
+        return !(sv_starts_with_nocase(cell_value, "inf") || sv_starts_with_nocase(cell_value, "nan"));
+    }
+    return true;
+}
+
+Column_Type cell_column_type(String_View cell_value)
+{
+    double number = 0.0;
+    if (parse_decimal(cell_value, &number)) {
+        return COLUMN_TYPE_NUMBER;
+    }
+    if (is_plain_text(cell_value)) {
+        return COLUMN_TYPE_TEXT;
+    }
+    return COLUMN_TYPE_MIXED;
+}
+
+// The type of a column is guessed from its first non-empty cell below the
+// header row, unless that cell is past the first COLUMN_SAMPLE_ROWS rows.
+// The guess is only a hint, the parser falls back to the general path for
+// the cells that don't fit and gives up on the type of their column.
+#define COLUMN_SAMPLE_ROWS 64
+
+// Cells that fail to parse are reported and become #PARSE! The cells of
+// the first `parsed_rows` x `parsed_cols` are already parsed and skipped.
+//
+// A `:^*` fill is a `:^` clone that the empty cells below it follow, up
+// to the next cell of the column that is not empty. They become `:^`
+// clones without being parsed, so a sheet filled down needs only one
+// fill per column and empty lines after it.
+void parse_table_from_content(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, String_View content, size_t parsed_rows, size_t parsed_cols)
 {
+    // Whether the empty cells of the column are filled
+    bool *filling = calloc(table->cols, sizeof(*filling));
+
+    // The parsed columns keep the types they already have
+    table->column_types = realloc(table->column_types, sizeof(*table->column_types) * table->cols);
+    for (size_t col = parsed_cols; col < table->cols; ++col) {
+        table->column_types[col] = COUNT_COLUMN_TYPES;
+    }
+    table->names.indexed = false;
+
     for (size_t row = 0; row < table->rows; ++row) {
         String_View line = sv_chop_by_delim(&content, '\n');
+        // The parsed rows still have to be scanned for the fills
+        if (row < parsed_rows && parsed_cols >= table->cols && !table->filled) {
+            continue;
+        }
+
         const char *const line_start = line.data;
         for (size_t col = 0; col < table->cols; ++col) {
             String_View cell_value = sv_trim(sv_chop_by_delim(&line, '|'));
+            if (cell_value.count > 0) {
+                filling[col] = sv_eq(cell_value, SV(":^*"));
+                table->filled = table->filled || filling[col];
+            }
+            if (row < parsed_rows && col < parsed_cols) {
+                continue;
+            }
+
             Cell_Index cell_index = {
                 .row = row,
                 .col = col,
             };
             Cell *cell = table_cell_at(table, cell_index);
-            cell->file_row = row + 1;
             cell->file_col = cell_value.data - line_start + 1;
-
-            if (sv_starts_with(cell_value, SV("="))) {
-                sv_chop_left(&cell_value, 1);
-                cell->kind = CELL_KIND_EXPR;
-                Lexer lexer = {
-                    .source = cell_value,
-                    .file_path = table->file_path,
-                    .file_row = cell->file_row,
-                    .line_start = line_start,
-                };
-                cell->as.expr.index = parse_expr(&lexer, tc, eb);
-                lexer_expect_no_tokens(&lexer);
-            } else if (sv_starts_with(cell_value, SV(":"))) {
-                sv_chop_left(&cell_value, 1);
+            Column_Type *type = &table->column_types[col];
+            if (row > 0 && *type == COUNT_COLUMN_TYPES && cell_value.count > 0) {
+                *type = row <= COLUMN_SAMPLE_ROWS ? cell_column_type(cell_value) : COLUMN_TYPE_MIXED;
+            }
+            double number = 0.0;
+            if (cell_value.count == 0 && filling[col]) {
                 cell->kind = CELL_KIND_CLONE;
-                if (sv_eq(cell_value, SV("<"))) {
-                    cell->as.clone = DIR_LEFT;
-                } else if (sv_eq(cell_value, SV(">"))) {
-                    cell->as.clone = DIR_RIGHT;
-                } else if (sv_eq(cell_value, SV("^"))) {
-                    cell->as.clone = DIR_UP;
-                } else if (sv_eq(cell_value, SV("v"))) {
-                    cell->as.clone = DIR_DOWN;
-                } else {
-                    fprintf(stderr, "%s:%zu:%zu: ERROR: "SV_Fmt" is not a correct direction to clone a cell from\n", table->file_path, cell->file_row, cell->file_col, SV_Arg(cell_value));
-                    exit(1);
-                }
+                cell->cloned = true;
+                cell->clone_dir = DIR_UP;
+            } else if (row > 0 && *type == COLUMN_TYPE_NUMBER && parse_decimal(cell_value, &number)) {
+                cell->cloned = false;
+                cell->kind = CELL_KIND_NUMBER;
+                cell->value = value_number(number);
+            } else if (row > 0 && *type == COLUMN_TYPE_TEXT && cell_value.count > 0 && is_plain_text(cell_value)) {
+                cell->cloned = false;
+                cell->kind = CELL_KIND_TEXT;
+                cell->value = table_push_text(table, cell_value);
             } else {
-                if (sv_strtod(cell_value, tc, &cell->as.number)) {
-                    cell->kind = CELL_KIND_NUMBER;
-                } else {
-                    cell->kind = CELL_KIND_TEXT;
-                    cell->as.text = cell_value;
+                if (row > 0 && cell_value.count > 0) {
+                    *type = COLUMN_TYPE_MIXED;
+                }
+                if (!parse_cell_from_content(table, eb, tc, cell, row + 1, cell_value, line_start)) {
+                    cell->cloned = false;
+                    cell_set_error(cell, ERROR_PARSE);
                 }
             }
         }
+
+        // The names of the columns are complete only after the header row
+        if (row == 0) {
+            table->names.indexed = false;
+        }
+    }
+
+    free(filling);
+}
+
+// Maps the file into memory, so only the parts of it that are actually
+// read get loaded. Returns NULL for the empty files.
+#ifndef _WIN32
+void *file_map(const char *file_path, size_t *size)
+{
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = statbuf.st_size;
+    return data;
+}
+
+void file_unmap(void *data, size_t size)
+{
+    munmap(data, size);
+}
+#else
+void *file_map(const char *file_path, size_t *size)
+{
+    return slurp_file(file_path, size);
+}
+
+void file_unmap(void *data, size_t size)
+{
+    (void) size;
+    free(data);
+}
+#endif // _WIN32
+
+// The first `lines` lines of the content. `complete` tells whether that
+// is all of it.
+String_View take_lines(String_View content, size_t lines, bool *complete)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < lines && size < content.count; ++i) {
+        const char *eol = memchr(content.data + size, '\n', content.count - size);
+        size = eol ? (size_t) (eol - content.data) + 1 : content.count;
     }
+
+    *complete = size == content.count;
+    return (String_View) {
+        .count = size,
+        .data = content.data,
+    };
 }
 
 void estimate_table_size(String_View content, size_t *out_rows, size_t *out_cols)
@@ -661,87 +2101,181 @@ void estimate_table_size(String_View content, size_t *out_rows, size_t *out_cols
     }
 }
 
-void table_eval_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index);
+Value table_eval_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index);
+bool table_contains(const Table *table, Cell_Index index);
+size_t table_cell_offset(const Table *table, Cell_Index index);
+
+// Clones don't copy the expression of the cell they clone. A cloned
+// expression cell shares the expression of its source, the first cell
+// down the chain of clones that is not a clone, and evaluates it with
+// every reference moved by the distance between the two. The distance
+// wraps around like the indices do, so (size_t) -1 moves up or to the
+// left. The problems of such an evaluation are reported at the clone.
+typedef struct {
+    Cell_Index shift;
+    size_t file_row;
+    size_t file_col;
+} Clone_Site;
 
-double table_eval_expr(Table *table, Expr_Buffer *eb, Expr_Index expr_index)
+Clone_Site table_clone_site(Table *table, Cell_Index cell_index)
 {
-    Expr *expr = expr_buffer_at(eb, expr_index);
+    const Cell *cell = table_cell_at(table, cell_index);
+    assert(cell->cloned && cell->kind == CELL_KIND_EXPR);
+    return (Clone_Site) {
+        .shift = {
+            .row = cell_index.row - cell->source / table->cols,
+            .col = cell_index.col - cell->source % table->cols,
+        },
+        .file_row = cell_index.row + 1,
+        .file_col = cell->file_col,
+    };
+}
 
-    switch (expr->kind) {
-    case EXPR_KIND_NUMBER:
-        return expr->as.number;
+// The cell the reference points at when evaluated at `clone`, NULL for
+// the cell the expression belongs to
+Cell_Index clone_move(const Clone_Site *clone, Cell_Index index)
+{
+    if (clone) {
+        index.row += clone->shift.row;
+        index.col += clone->shift.col;
+    }
+    return index;
+}
 
-    case EXPR_KIND_CELL: {
-        table_eval_cell(table, eb, expr->as.cell);
+size_t expr_file_row(const Expr *expr, const Clone_Site *clone)
+{
+    return clone ? clone->file_row : expr->file_row;
+}
 
-        Cell *target_cell = table_cell_at(table, expr->as.cell);
-        switch (target_cell->kind) {
-        case CELL_KIND_NUMBER:
-            return target_cell->as.number;
-        case CELL_KIND_TEXT: {
-            fprintf(stderr, "%s:%zu:%zu: ERROR: text cells may not participate in math expressions\n", expr->file_path, expr->file_row, expr->file_col);
-            fprintf(stderr, "%s:%zu:%zu: NOTE: the text cell is located here\n",
-                    table->file_path, target_cell->file_row, target_cell->file_col);
-            exit(1);
-        }
+size_t expr_file_col(const Expr *expr, const Clone_Site *clone)
+{
+    return clone ? clone->file_col : expr->file_col;
+}
 
-        case CELL_KIND_EXPR:
-            return target_cell->as.expr.value;
+double table_eval_expr(Table *table, Expr_Buffer *eb, Expr_Index expr_index, const Clone_Site *clone);
 
-        case CELL_KIND_CLONE:
-            UNREACHABLE("cell should never be a clone after the evaluation");
+// NaN results are rare, so only then look for the error that caused them.
+// The leftmost error wins, whatever the hardware propagates.
+double bop_propagate_error(double result, double lhs, double rhs)
+{
+    if (result != result) {
+        if (number_is_error(lhs)) return lhs;
+        if (number_is_error(rhs)) return rhs;
+    }
+    return result;
+}
+
+double workbook_eval_cell(const Expr *expr, const Clone_Site *clone, bool report);
+
+double table_eval_expr_node(Table *table, Expr_Buffer *eb, Expr_Index expr_index, const Clone_Site *clone)
+{
+    // The evaluation never grows the buffer
+    const Expr *expr = expr_buffer_at(eb, expr_index);
+    // The shared expressions are evaluated once per pass, unless the
+    // references are moved. The errors are evaluated every time, so every
+    // occurrence reports its diagnostics like an unshared one would.
+    bool memo = eb->hashcons && clone == NULL;
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        return expr->as.number;
+
+    case EXPR_KIND_SHEET_CELL:
+        return workbook_eval_cell(expr, clone, true);
+
+    case EXPR_KIND_CELL: {
+        Cell_Index cell_index = clone_move(clone, expr->as.cell);
+        if (!table_contains(table, cell_index)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: cell reference outside of the table\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+            return error_number(ERROR_REF);
+        }
+
+        Value value = table_eval_cell(table, eb, cell_index);
+        switch (value_type(value)) {
+        case VALUE_NUMBER:
+        case VALUE_ERROR:
+            return value.number;
+        case VALUE_TEXT:
+        case VALUE_EMPTY: {
+            Cell *target_cell = table_cell_at(table, cell_index);
+            fprintf(stderr, "%s:%zu:%zu: ERROR: text cells may not participate in math expressions\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+            fprintf(stderr, "%s:%zu:%zu: NOTE: the text cell is located here\n",
+                    table->file_path, cell_index.row + 1, target_cell->file_col);
+            return error_number(ERROR_VALUE);
+        }
+        default:
+            UNREACHABLE("unknown Value Type");
         }
     }
-    break;
 
     case EXPR_KIND_BOP: {
-        double lhs = table_eval_expr(table, eb, expr->as.bop.lhs);
-        double rhs = table_eval_expr(table, eb, expr->as.bop.rhs);
+        if (memo && eb->memo_passes[expr_index] == eb->pass) {
+            return eb->memo_values[expr_index];
+        }
+
+        double lhs = table_eval_expr(table, eb, expr->as.bop.lhs, clone);
+        double rhs = table_eval_expr(table, eb, expr->as.bop.rhs, clone);
 
+        double result = 0.0;
         switch (expr->as.bop.kind) {
         case BOP_KIND_PLUS:
-            return lhs + rhs;
+            result = lhs + rhs;
+            break;
         case BOP_KIND_MINUS:
-            return lhs - rhs;
+            result = lhs - rhs;
+            break;
         case BOP_KIND_MULT:
-            return lhs * rhs;
+            result = lhs * rhs;
+            break;
         case BOP_KIND_DIV:
-            return lhs / rhs;
+            if (rhs == 0.0) {
+                if (!number_is_error(lhs)) {
+                    fprintf(stderr, "%s:%zu:%zu: ERROR: division by zero\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+                }
+                result = error_number(ERROR_DIV0);
+            } else {
+                result = lhs / rhs;
+            }
+            break;
         case COUNT_BOP_KINDS:
         default:
             UNREACHABLE("unknown Binary Operator Kind");
         }
+        result = bop_propagate_error(result, lhs, rhs);
+
+        if (memo && !number_is_error(result)) {
+            eb->memo_values[expr_index] = result;
+            eb->memo_passes[expr_index] = eb->pass;
+        }
+        return result;
     }
-    break;
 
     case EXPR_KIND_UOP: {
-        double param = table_eval_expr(table, eb, expr->as.uop.param);
+        if (memo && eb->memo_passes[expr_index] == eb->pass) {
+            return eb->memo_values[expr_index];
+        }
+
+        double param = table_eval_expr(table, eb, expr->as.uop.param, clone);
 
+        double result = 0.0;
         switch (expr->as.uop.kind) {
         case UOP_KIND_MINUS:
-            return -param;
+            // Flips only the sign bit, the error payload stays intact
+            result = -param;
+            break;
         default:
             UNREACHABLE("unknown Unary Operator Kind");
         }
+
+        if (memo && !number_is_error(result)) {
+            eb->memo_values[expr_index] = result;
+            eb->memo_passes[expr_index] = eb->pass;
+        }
+        return result;
     }
-    break;
-    }
-    return 0;
-}
 
-Dir opposite_dir(Dir dir)
-{
-    switch (dir) {
-    case DIR_LEFT:
-        return DIR_RIGHT;
-    case DIR_RIGHT:
-        return DIR_LEFT;
-    case DIR_UP:
-        return DIR_DOWN;
-    case DIR_DOWN:
-        return DIR_UP;
     default:
-        UNREACHABLE("unknown direction");
+        UNREACHABLE("unknown Expression Kind");
     }
 }
 
@@ -767,133 +2301,189 @@ Cell_Index nbor_in_dir(Cell_Index index, Dir dir)
     return index;
 }
 
-Expr_Index move_expr_in_dir(Table *table, Cell_Index cell_index, Expr_Buffer *eb, Expr_Index root, Dir dir)
-{
-    Cell *cell = table_cell_at(table, cell_index);
+// Profiler (--profile)
+//
+// Every expression or clone cell gets a frame on the profiler stack for
+// the time of its evaluation. The time and the amount of expression nodes
+// spent in the nested cells are subtracted from the parent to get the
+// exclusive cost. The depth of a cell is the length of the longest chain
+// of cells it depends on.
 
-    switch (expr_buffer_at(eb, root)->kind) {
-    case EXPR_KIND_NUMBER:
-        return root;
+typedef struct {
+    double inclusive_secs;
+    double exclusive_secs;
+    size_t inclusive_nodes;
+    size_t exclusive_nodes;
+    size_t depth;
+    size_t fan_in;
+    size_t fan_out;
+} Cell_Profile;
 
-    case EXPR_KIND_CELL: {
-        Expr_Index new_index = expr_buffer_alloc(eb);
-        {
-            Expr *new_expr = expr_buffer_at(eb, new_index);
-            new_expr->kind = EXPR_KIND_CELL;
-            new_expr->as.cell = nbor_in_dir(expr_buffer_at(eb, root)->as.cell, dir);
-            new_expr->file_path = table->file_path;
-            new_expr->file_row = cell->file_row;
-            new_expr->file_col = cell->file_col;
-        }
+typedef struct {
+    Cell_Index cell;
+    double start_secs;
+    size_t start_nodes;
+    double children_secs;
+    size_t children_nodes;
+    size_t max_child_depth;
+} Profile_Frame;
+
+struct Profiler {
+    Cell_Profile *cells;
+    Profile_Frame *frames;
+    size_t frames_count;
+    size_t frames_capacity;
+    size_t nodes;
+};
 
-        return new_index;
+void profiler_enter(Table *table, Cell_Index cell_index)
+{
+    Profiler *p = table->profiler;
+    if (p->frames_count >= p->frames_capacity) {
+        p->frames_capacity = p->frames_capacity == 0 ? 64 : p->frames_capacity * 2;
+        p->frames = realloc(p->frames, sizeof(*p->frames) * p->frames_capacity);
     }
-    break;
-
-    case EXPR_KIND_BOP: {
-        Expr_Bop bop = {0};
-
-        {
-            Expr *root_expr = expr_buffer_at(eb, root);
-            bop = root_expr->as.bop;
-        }
 
-        bop.lhs = move_expr_in_dir(table, cell_index, eb, bop.lhs, dir);
-        bop.rhs = move_expr_in_dir(table, cell_index, eb, bop.rhs, dir);
-
-        Expr_Index new_index = expr_buffer_alloc(eb);
-        {
-            Expr *new_expr = expr_buffer_at(eb, new_index);
-            new_expr->kind = EXPR_KIND_BOP;
-            new_expr->as.bop = bop;
-            new_expr->file_path = table->file_path;
-            new_expr->file_row = cell->file_row;
-            new_expr->file_col = cell->file_col;
-        }
+    p->frames[p->frames_count++] = (Profile_Frame) {
+        .cell = cell_index,
+        .start_secs = clock_wall_secs(),
+        .start_nodes = p->nodes,
+    };
+}
 
-        return new_index;
+void profiler_leave(Table *table, Cell_Index cell_index)
+{
+    Profiler *p = table->profiler;
+    assert(p->frames_count > 0);
+    Profile_Frame frame = p->frames[--p->frames_count];
+    assert(frame.cell.row == cell_index.row && frame.cell.col == cell_index.col);
+
+    Cell_Profile *cp = &p->cells[table_cell_offset(table, cell_index)];
+    cp->inclusive_secs = clock_wall_secs() - frame.start_secs;
+    cp->exclusive_secs = cp->inclusive_secs - frame.children_secs;
+    cp->inclusive_nodes = p->nodes - frame.start_nodes;
+    cp->exclusive_nodes = cp->inclusive_nodes - frame.children_nodes;
+    cp->depth = frame.max_child_depth + 1;
+
+    if (p->frames_count > 0) {
+        Profile_Frame *parent = &p->frames[p->frames_count - 1];
+        parent->children_secs += cp->inclusive_secs;
+        parent->children_nodes += cp->inclusive_nodes;
     }
-    break;
+}
 
-    case EXPR_KIND_UOP: {
-        Expr_Uop uop = {0};
-        {
-            Expr *root_expr = expr_buffer_at(eb, root);
-            uop = root_expr->as.uop;
+// Called for every cell a frame depends on, evaluated just now or before
+void profiler_visit(Table *table, Cell_Index cell_index)
+{
+    Profiler *p = table->profiler;
+    if (p->frames_count > 0) {
+        Profile_Frame *parent = &p->frames[p->frames_count - 1];
+        size_t depth = p->cells[table_cell_offset(table, cell_index)].depth;
+        if (parent->max_child_depth < depth) {
+            parent->max_child_depth = depth;
         }
+    }
+}
 
-        uop.param = move_expr_in_dir(table, cell_index, eb, uop.param, dir);
-
-        Expr_Index new_index = expr_buffer_alloc(eb);
-        {
-            Expr *new_expr = expr_buffer_at(eb, new_index);
-            new_expr->kind = EXPR_KIND_UOP;
-            new_expr->as.uop = uop;
-            new_expr->file_path = table->file_path;
-            new_expr->file_row = cell->file_row;
-            new_expr->file_col = cell->file_col;
-        }
+void table_mark_evaluated(Table *table, Cell *cell, Cell_Index cell_index)
+{
+    if (table->eval_order && cell->status != EVALUATED) {
+        cell_indices_push(table->eval_order, cell_index);
+    }
+    cell->status = EVALUATED;
+}
 
-        return new_index;
+double table_eval_expr(Table *table, Expr_Buffer *eb, Expr_Index expr_index, const Clone_Site *clone)
+{
+    stats.eval_depth += 1;
+    if (stats.max_eval_depth < stats.eval_depth) {
+        stats.max_eval_depth = stats.eval_depth;
     }
-    break;
+    if (table->profiler) {
+        table->profiler->nodes += 1;
+    }
+    double value = table_eval_expr_node(table, eb, expr_index, clone);
+    stats.eval_depth -= 1;
+    return value;
+}
 
-    default:
-        UNREACHABLE("Unknown Expression Kind");
+// The value of the cell as seen by the expressions referencing it. A cell
+// that is still being evaluated is a #CYCLE!.
+Value cell_value(const Cell *cell)
+{
+    if (cell->status == INPROGRESS) {
+        return value_error(ERROR_CYCLE);
     }
+    assert(cell->kind != CELL_KIND_CLONE && "cell should never be a clone after the evaluation");
+    return cell->value;
 }
 
-void table_eval_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
+Value table_eval_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
 {
     Cell *cell = table_cell_at(table, cell_index);
 
     switch (cell->kind) {
     case CELL_KIND_TEXT:
     case CELL_KIND_NUMBER:
-        cell->status = EVALUATED;
+        table_mark_evaluated(table, cell, cell_index);
         break;
     case CELL_KIND_EXPR: {
         if (cell->status == INPROGRESS) {
-            fprintf(stderr, "%s:%zu:%zu: ERROR: circular dependency is detected!\n", table->file_path, cell->file_row, cell->file_col);
-            exit(1);
+            fprintf(stderr, "%s:%zu:%zu: ERROR: circular dependency is detected!\n", table->file_path, cell_index.row + 1, cell->file_col);
+            return value_error(ERROR_CYCLE);
         }
 
         if (cell->status == UNEVALUATED) {
             cell->status = INPROGRESS;
-            cell->as.expr.value = table_eval_expr(table, eb, cell->as.expr.index);
-            cell->status = EVALUATED;
+            if (table->profiler) profiler_enter(table, cell_index);
+            if (cell->cloned) {
+                Clone_Site clone = table_clone_site(table, cell_index);
+                cell->value = value_number(table_eval_expr(table, eb, cell->expr, &clone));
+            } else {
+                cell->value = value_number(table_eval_expr(table, eb, cell->expr, NULL));
+            }
+            if (table->profiler) profiler_leave(table, cell_index);
+            table_mark_evaluated(table, cell, cell_index);
         }
     }
     break;
 
     case CELL_KIND_CLONE: {
         if (cell->status == INPROGRESS) {
-            fprintf(stderr, "%s:%zu:%zu: ERROR: circular dependency is detected!\n", table->file_path, cell->file_row, cell->file_col);
-            exit(1);
+            fprintf(stderr, "%s:%zu:%zu: ERROR: circular dependency is detected!\n", table->file_path, cell_index.row + 1, cell->file_col);
+            return value_error(ERROR_CYCLE);
         }
 
         if (cell->status == UNEVALUATED) {
             cell->status = INPROGRESS;
+            if (table->profiler) profiler_enter(table, cell_index);
 
-            Dir dir = cell->as.clone;
-            Cell_Index nbor_index = nbor_in_dir(cell_index, dir);
+            Cell_Index nbor_index = nbor_in_dir(cell_index, cell->clone_dir);
             if (nbor_index.row >= table->rows || nbor_index.col >= table->cols) {
-                fprintf(stderr, "%s:%zu:%zu: ERROR: trying to clone a cell outside of the table\n", table->file_path, cell->file_row, cell->file_col);
-                exit(1);
-            }
-
-            table_eval_cell(table, eb, nbor_index);
+                fprintf(stderr, "%s:%zu:%zu: ERROR: trying to clone a cell outside of the table\n", table->file_path, cell_index.row + 1, cell->file_col);
+                cell_set_error(cell, ERROR_REF);
+            } else {
+                table_eval_cell(table, eb, nbor_index);
 
-            Cell *nbor = table_cell_at(table, nbor_index);
-            cell->kind = nbor->kind;
-            cell->as = nbor->as;
+                Cell *nbor = table_cell_at(table, nbor_index);
+                if (nbor->status != EVALUATED) {
+                    // The neighbor is somewhere up the stack
+                    cell_set_error(cell, ERROR_CYCLE);
+                } else {
+                    cell->kind = nbor->kind;
+                    cell->value = nbor->value;
+                    cell->expr = nbor->expr;
+                    cell->source = nbor->cloned ? nbor->source : table_cell_offset(table, nbor_index);
+                }
 
-            if (cell->kind == CELL_KIND_EXPR) {
-                cell->as.expr.index = move_expr_in_dir(table, cell_index, eb, cell->as.expr.index, opposite_dir(dir));
-                cell->as.expr.value = table_eval_expr(table, eb, cell->as.expr.index);
+                if (cell->kind == CELL_KIND_EXPR) {
+                    Clone_Site clone = table_clone_site(table, cell_index);
+                    cell->value = value_number(table_eval_expr(table, eb, cell->expr, &clone));
+                }
             }
 
-            cell->status = EVALUATED;
+            if (table->profiler) profiler_leave(table, cell_index);
+            table_mark_evaluated(table, cell, cell_index);
         } else {
             UNREACHABLE("evaluated clones are an absurd. When a clone cell is evaluated it becomes its neighbor kind");
         }
@@ -903,139 +2493,4584 @@ void table_eval_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
     default:
         UNREACHABLE("unknown Cell Kind");
     }
+
+    if (table->profiler) profiler_visit(table, cell_index);
+    return cell_value(cell);
 }
 
-int main(int argc, char **argv)
+// Incremental recalculation
+//
+// After the first full evaluation table_build_dependents() records for
+// each cell the cells that depend on it: the cells that reference it in
+// their expressions and the clones that copy it. table_set_cell() replaces
+// the content of a cell and table_recalc() recomputes only the changed
+// cells and their transitive dependents in topological order.
+
+size_t table_cell_offset(const Table *table, Cell_Index index)
 {
-    if (argc < 2) {
-        usage(stderr);
-        fprintf(stderr, "ERROR: input file is not provided\n");
-        exit(1);
-    }
+    return index.row * table->cols + index.col;
+}
 
-    const char *input_file_path = argv[1];
+bool table_contains(const Table *table, Cell_Index index)
+{
+    return index.row < table->rows && index.col < table->cols;
+}
 
-    size_t content_size = 0;
-    char *content = slurp_file(input_file_path, &content_size);
-    if (content == NULL) {
-        fprintf(stderr, "ERROR: could not read file %s: %s\n",
-                input_file_path, strerror(errno));
-        exit(1);
+// Whether the cell outside of the table may still be in the part of the
+// file that is not parsed yet. Such cells are recorded in rows_needed.
+bool table_need_row(Table *table, Cell_Index index)
+{
+    // Moving the references up from the first row wraps around
+    if (!table->partial || index.row < table->rows || index.row > SIZE_MAX / 2) {
+        return false;
     }
 
-    String_View input = {
-        .count = content_size,
-        .data = content,
-    };
+    if (table->rows_needed < index.row + 1) {
+        table->rows_needed = index.row + 1;
+    }
+    return true;
+}
 
-    Expr_Buffer eb = {0};
-    Table table = {
-        .file_path = input_file_path,
-    };
-    Tmp_Cstr tc = {0};
+void expr_collect_cells(Expr_Buffer *eb, Expr_Index expr_index, const Clone_Site *clone, Cell_Indices *out)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        break;
 
-    estimate_table_size(input, &table.rows, &table.cols);
-    table.cells = malloc(sizeof(*table.cells) * table.rows * table.cols);
-    memset(table.cells, 0, sizeof(*table.cells) * table.rows * table.cols);
-    parse_table_from_content(&table, &eb, &tc, input);
+    case EXPR_KIND_CELL:
+        cell_indices_push(out, clone_move(clone, expr->as.cell));
+        break;
 
-    // Evaluate each cell
-    for (size_t row = 0; row < table.rows; ++row) {
-        for (size_t col = 0; col < table.cols; ++col) {
-            Cell_Index cell_index = {
-                .row = row,
-                .col = col,
-            };
-            table_eval_cell(&table, &eb, cell_index);
-        }
+    // The other sheets are evaluated on their own before
+    case EXPR_KIND_SHEET_CELL:
+        break;
+
+    case EXPR_KIND_BOP:
+        expr_collect_cells(eb, expr->as.bop.lhs, clone, out);
+        expr_collect_cells(eb, expr->as.bop.rhs, clone, out);
+        break;
+
+    case EXPR_KIND_UOP:
+        expr_collect_cells(eb, expr->as.uop.param, clone, out);
+        break;
+
+    default:
+        UNREACHABLE("unknown Expression Kind");
     }
+}
 
-    // Estimate column widths
-    size_t *col_widths = malloc(sizeof(size_t) * table.cols);
-    {
-        for (size_t col = 0; col < table.cols; ++col) {
-            col_widths[col] = 0;
-            for (size_t row = 0; row < table.rows; ++row) {
-                Cell_Index cell_index = {
-                    .row = row,
-                    .col = col,
-                };
+// Appends the cells the expression of the expression cell references to
+// `table->precedents`
+void table_collect_expr_cells(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
+{
+    Cell *cell = table_cell_at(table, cell_index);
+    if (cell->cloned) {
+        Clone_Site clone = table_clone_site(table, cell_index);
+        expr_collect_cells(eb, cell->expr, &clone, &table->precedents);
+    } else {
+        expr_collect_cells(eb, cell->expr, NULL, &table->precedents);
+    }
+}
 
-                Cell *cell = table_cell_at(&table, cell_index);
-                size_t width = 0;
-                switch (cell->kind) {
-                case CELL_KIND_TEXT:
-                    width = cell->as.text.count;
-                    break;
+// Collects the cells `cell_index` depends on into `table->precedents`
+void table_collect_precedents(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
+{
+    table->precedents.count = 0;
 
-                case CELL_KIND_NUMBER: {
-                    int n = snprintf(NULL, 0, "%lf", cell->as.number);
-                    assert(n >= 0);
-                    width = (size_t) n;
-                }
-                break;
+    Cell *cell = table_cell_at(table, cell_index);
+    if (cell->cloned) {
+        cell_indices_push(&table->precedents, nbor_in_dir(cell_index, cell->clone_dir));
+    }
 
-                case CELL_KIND_EXPR: {
-                    int n = snprintf(NULL, 0, "%lf", cell->as.expr.value);
-                    assert(n >= 0);
-                    width = (size_t) n;
-                }
-                break;
+    if (cell->kind == CELL_KIND_EXPR) {
+        table_collect_expr_cells(table, eb, cell_index);
+    }
+}
 
-                case CELL_KIND_CLONE:
-                    UNREACHABLE("cell should never be a clone after the evaluation");
-                }
+// The dependents of the cell, ready to be changed. A fork borrows the
+// items of the lists from its snapshot, marked by the zero capacity,
+// until it changes them.
+Cell_Indices *table_own_dependents(Table *table, size_t offset)
+{
+    Cell_Indices *deps = &table->dependents[offset];
+    if (deps->capacity == 0 && deps->count > 0) {
+        Cell_Index *items = malloc(sizeof(*items) * deps->count);
+        memcpy(items, deps->items, sizeof(*items) * deps->count);
+        deps->items = items;
+        deps->capacity = deps->count;
+    }
+    return deps;
+}
 
-                if (col_widths[col] < width) {
-                    col_widths[col] = width;
-                }
+void table_link_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
+{
+    table_collect_precedents(table, eb, cell_index);
+    for (size_t i = 0; i < table->precedents.count; ++i) {
+        Cell_Index precedent = table->precedents.items[i];
+        if (table_contains(table, precedent)) {
+            cell_indices_push(table_own_dependents(table, table_cell_offset(table, precedent)), cell_index);
+        }
+    }
+}
+
+void table_unlink_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index)
+{
+    table_collect_precedents(table, eb, cell_index);
+    for (size_t i = 0; i < table->precedents.count; ++i) {
+        Cell_Index precedent = table->precedents.items[i];
+        if (!table_contains(table, precedent)) {
+            continue;
+        }
+
+        Cell_Indices *deps = table_own_dependents(table, table_cell_offset(table, precedent));
+        for (size_t j = 0; j < deps->count; ++j) {
+            if (deps->items[j].row == cell_index.row && deps->items[j].col == cell_index.col) {
+                deps->items[j] = deps->items[--deps->count];
+                break;
             }
         }
     }
+}
 
-    // Render the table
-    for (size_t row = 0; row < table.rows; ++row) {
-        for (size_t col = 0; col < table.cols; ++col) {
+// Expects the table to be fully evaluated
+void table_build_dependents(Table *table, Expr_Buffer *eb)
+{
+    assert(table->dependents == NULL);
+
+    size_t n = table->rows * table->cols;
+    table->dependents = calloc(n, sizeof(*table->dependents));
+    table->dirty = calloc(n, sizeof(*table->dirty));
+    table->dirty_node = calloc(n, sizeof(*table->dirty_node));
+
+    for (size_t row = 0; row < table->rows; ++row) {
+        for (size_t col = 0; col < table->cols; ++col) {
             Cell_Index cell_index = {
                 .row = row,
                 .col = col,
             };
+            table_link_cell(table, eb, cell_index);
+        }
+    }
+}
 
-            Cell *cell = table_cell_at(&table, cell_index);
-            int n = 0;
-            switch (cell->kind) {
-            case CELL_KIND_TEXT:
-                n = printf(SV_Fmt, SV_Arg(cell->as.text));
-                break;
+// Replaces the content of the cell with an already parsed one. The change
+// takes effect on the next table_recalc().
+void table_replace_cell(Table *table, Expr_Buffer *eb, Cell_Index cell_index, Cell cell)
+{
+    assert(table->dependents != NULL);
+    assert(table_contains(table, cell_index));
+
+    size_t offset = table_cell_offset(table, cell_index);
+    if (!table->dirty[offset]) {
+        table_unlink_cell(table, eb, cell_index);
+        table->dirty[offset] = true;
+        cell_indices_push(&table->changed, cell_index);
+    }
 
-            case CELL_KIND_NUMBER:
-                n = printf("%lf", cell->as.number);
-                break;
+    // The formulas parsed from now on see the new names
+    if (cell_index.row == 0) {
+        table->names.indexed = false;
+    }
 
-            case CELL_KIND_EXPR:
-                n = printf("%lf", cell->as.expr.value);
-                break;
+    Cell *dst = table_cell_at(table, cell_index);
+    cell.file_col = dst->file_col;
+    if (cell.cloned) {
+        cell.kind = CELL_KIND_CLONE;
+    }
+    cell.status = UNEVALUATED;
+    *dst = cell;
+}
 
-            case CELL_KIND_CLONE:
-                UNREACHABLE("cell should never be a clone after the evaluation");
-            }
-            assert(0 <= n);
-            assert((size_t) n <= col_widths[col]);
-            printf("%*s", (int) (col_widths[col] - n), "");
+// `source` is the content of the cell as it would appear in the CSV
+// file. Text cells keep a view into it, so it must outlive the table.
+// The change takes effect on the next table_recalc(). Returns false if
+// the source does not parse, the cell becomes #PARSE! then.
+bool table_set_cell(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, Cell_Index cell_index, String_View source)
+{
+    Cell old = *table_cell_at(table, cell_index);
+    Cell cell = old;
+    source = sv_trim(source);
+    bool ok = parse_cell_from_content(table, eb, tc, &cell, cell_index.row + 1, source, source.data);
+    if (!ok) {
+        cell.cloned = false;
+        cell_set_error(&cell, ERROR_PARSE);
+    }
+
+    // Text replaced by text takes over the slot of the old one, so editing
+    // the text cells doesn't grow the text table. Clones of text share
+    // the slot of the cell they clone, they don't own it.
+    if (!old.cloned && old.kind == CELL_KIND_TEXT && value_type(old.value) == VALUE_TEXT &&
+            cell.kind == CELL_KIND_TEXT && value_type(cell.value) == VALUE_TEXT) {
+        assert(value_text_index(cell.value) + 1 == table->texts.count);
+        table->texts.items[value_text_index(old.value)] = table->texts.items[--table->texts.count];
+        cell.value = old.value;
+    }
 
-            if (col < table.cols - 1) {
-                printf("|");
+    table_replace_cell(table, eb, cell_index, cell);
+    return ok;
+}
+
+void table_free(Table *table)
+{
+    size_t n = table->rows * table->cols;
+    if (table->dependents) {
+        for (size_t i = 0; i < n; ++i) {
+            // The borrowed ones belong to the snapshot
+            if (table->dependents[i].capacity > 0) {
+                free(table->dependents[i].items);
             }
         }
-        printf("\n");
     }
+    if (table->mapped) {
+        file_unmap(table->dependents, sizeof(*table->dependents) * n);
+        file_unmap(table->cells, sizeof(*table->cells) * n);
+        file_unmap(table->dirty, sizeof(*table->dirty) * n);
+        file_unmap(table->dirty_node, sizeof(*table->dirty_node) * n);
+    } else {
+        free(table->dependents);
+        free(table->cells);
+        free(table->dirty);
+        free(table->dirty_node);
+    }
+    if (table->texts.mapped) {
+        file_unmap(table->texts.items, sizeof(*table->texts.items) * table->texts.capacity);
+    } else {
+        free(table->texts.items);
+    }
+    free(table->changed.items);
+    free(table->order.items);
+    free(table->precedents.items);
+    free(table->column_types);
+    free(table->names.slots);
+}
 
-    free(col_widths);
-    free(content);
-    free(table.cells);
-    free(eb.items);
-    free(tc.cstr);
+// Constant folding
+//
+// Folds constant subtrees into EXPR_KIND_NUMBER nodes, cancels double
+// negations and applies algebraic identities that hold for every IEEE
+// 754 value including NaNs, infinities and signed zeros. With `fast_math`
+// it also reassociates constants (`1+(2+A1)` becomes `3+A1`) and drops
+// `x+0` and `x*0`, which may change the result for -0.0, NaN or infinity
+// and hide errors from text cells multiplied by zero.
+//
+// The nodes are rewritten in place. That is fine even for nodes shared by
+// hash-consing: all the sharers have the same structure, so they would be
+// folded the same way.
 
-    return 0;
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Expr_Index *items;
+} Expr_Indices;
+
+void expr_indices_push(Expr_Indices *ei, Expr_Index index)
+{
+    if (ei->count >= ei->capacity) {
+        ei->capacity = ei->capacity == 0 ? 16 : ei->capacity * 2;
+        ei->items = realloc(ei->items, sizeof(*ei->items) * ei->capacity);
+    }
+
+    ei->items[ei->count++] = index;
+}
+
+bool expr_is_number(Expr_Buffer *eb, Expr_Index index, double number)
+{
+    Expr *expr = expr_buffer_at(eb, index);
+    return expr->kind == EXPR_KIND_NUMBER && memcmp(&expr->as.number, &number, sizeof(number)) == 0;
+}
+
+bool expr_is_uop(Expr_Buffer *eb, Expr_Index index, Uop_Kind kind)
+{
+    Expr *expr = expr_buffer_at(eb, index);
+    return expr->kind == EXPR_KIND_UOP && expr->as.uop.kind == kind;
 }
 
+double eval_bop(Bop_Kind kind, double lhs, double rhs)
+{
+    switch (kind) {
+    case BOP_KIND_PLUS:
+        return lhs + rhs;
+    case BOP_KIND_MINUS:
+        return lhs - rhs;
+    case BOP_KIND_MULT:
+        return lhs * rhs;
+    case BOP_KIND_DIV:
+        return lhs / rhs;
+    case COUNT_BOP_KINDS:
+    default:
+        UNREACHABLE("unknown Binary Operator Kind");
+    }
+}
+
+// Folds the node whose operands are folded already, returns the node
+// that replaces it
+Expr_Index expr_fold_node(Expr_Buffer *eb, Expr_Index index, bool fast_math)
+{
+    switch (expr_buffer_at(eb, index)->kind) {
+    case EXPR_KIND_NUMBER:
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_SHEET_CELL:
+        return index;
+
+    case EXPR_KIND_UOP: {
+        Expr *expr = expr_buffer_at(eb, index);
+        Expr_Index param = expr->as.uop.param;
+
+        assert(expr->as.uop.kind == UOP_KIND_MINUS);
+        Expr *param_expr = expr_buffer_at(eb, param);
+        if (param_expr->kind == EXPR_KIND_NUMBER) {
+            double number = -param_expr->as.number;
+            expr->kind = EXPR_KIND_NUMBER;
+            expr->as.number = number;
+            return index;
+        }
+
+        // -(-x) => x
+        if (expr_is_uop(eb, param, UOP_KIND_MINUS)) {
+            return param_expr->as.uop.param;
+        }
+
+        return index;
+    }
+
+    case EXPR_KIND_BOP: {
+        Expr_Bop bop = expr_buffer_at(eb, index)->as.bop;
+        Expr *lhs = expr_buffer_at(eb, bop.lhs);
+        Expr *rhs = expr_buffer_at(eb, bop.rhs);
+        // Division by zero is left for the evaluation to report as #DIV/0!
+        bool div0 = bop.kind == BOP_KIND_DIV && rhs->kind == EXPR_KIND_NUMBER && rhs->as.number == 0.0;
+        if (lhs->kind == EXPR_KIND_NUMBER && rhs->kind == EXPR_KIND_NUMBER && !div0) {
+            double number = eval_bop(bop.kind, lhs->as.number, rhs->as.number);
+            Expr *expr = expr_buffer_at(eb, index);
+            expr->kind = EXPR_KIND_NUMBER;
+            expr->as.number = number;
+            return index;
+        }
+
+        switch (bop.kind) {
+        case BOP_KIND_PLUS:
+            // x + -0 => x
+            if (expr_is_number(eb, bop.rhs, -0.0)) return bop.lhs;
+            if (expr_is_number(eb, bop.lhs, -0.0)) return bop.rhs;
+            // x + (-y) => x - y
+            if (expr_is_uop(eb, bop.rhs, UOP_KIND_MINUS)) {
+                Expr *expr = expr_buffer_at(eb, index);
+                expr->as.bop.kind = BOP_KIND_MINUS;
+                expr->as.bop.rhs = rhs->as.uop.param;
+                return index;
+            }
+            if (fast_math) {
+                if (expr_is_number(eb, bop.rhs, 0.0)) return bop.lhs;
+                if (expr_is_number(eb, bop.lhs, 0.0)) return bop.rhs;
+            }
+            break;
+
+        case BOP_KIND_MINUS:
+            // x - 0 => x
+            if (expr_is_number(eb, bop.rhs, 0.0)) return bop.lhs;
+            // x - (-y) => x + y
+            if (expr_is_uop(eb, bop.rhs, UOP_KIND_MINUS)) {
+                Expr *expr = expr_buffer_at(eb, index);
+                expr->as.bop.kind = BOP_KIND_PLUS;
+                expr->as.bop.rhs = rhs->as.uop.param;
+                return index;
+            }
+            break;
+
+        case BOP_KIND_MULT:
+            // x * 1 => x
+            if (expr_is_number(eb, bop.rhs, 1.0)) return bop.lhs;
+            if (expr_is_number(eb, bop.lhs, 1.0)) return bop.rhs;
+            // (-x) * (-y) => x * y
+            if (expr_is_uop(eb, bop.lhs, UOP_KIND_MINUS) && expr_is_uop(eb, bop.rhs, UOP_KIND_MINUS)) {
+                Expr *expr = expr_buffer_at(eb, index);
+                expr->as.bop.lhs = lhs->as.uop.param;
+                expr->as.bop.rhs = rhs->as.uop.param;
+                return index;
+            }
+            if (fast_math) {
+                if (expr_is_number(eb, bop.rhs, 0.0) || expr_is_number(eb, bop.lhs, 0.0)) {
+                    Expr *expr = expr_buffer_at(eb, index);
+                    expr->kind = EXPR_KIND_NUMBER;
+                    expr->as.number = 0.0;
+                    return index;
+                }
+            }
+            break;
+
+        case BOP_KIND_DIV:
+            // x / 1 => x
+            if (expr_is_number(eb, bop.rhs, 1.0)) return bop.lhs;
+            break;
+
+        case COUNT_BOP_KINDS:
+        default:
+            UNREACHABLE("unknown Binary Operator Kind");
+        }
+
+        // c op (d op y) => (c op d) op y, and the mirrored forms
+        if (fast_math && (bop.kind == BOP_KIND_PLUS || bop.kind == BOP_KIND_MULT)) {
+            Expr_Index c = bop.lhs;
+            Expr_Index inner = bop.rhs;
+            if (expr_buffer_at(eb, c)->kind != EXPR_KIND_NUMBER) {
+                c = bop.rhs;
+                inner = bop.lhs;
+            }
+
+            Expr *inner_expr = expr_buffer_at(eb, inner);
+            if (expr_buffer_at(eb, c)->kind == EXPR_KIND_NUMBER &&
+                    inner_expr->kind == EXPR_KIND_BOP &&
+                    inner_expr->as.bop.kind == bop.kind) {
+                Expr_Index d = inner_expr->as.bop.lhs;
+                Expr_Index y = inner_expr->as.bop.rhs;
+                if (expr_buffer_at(eb, d)->kind != EXPR_KIND_NUMBER) {
+                    d = inner_expr->as.bop.rhs;
+                    y = inner_expr->as.bop.lhs;
+                }
+
+                if (expr_buffer_at(eb, d)->kind == EXPR_KIND_NUMBER) {
+                    // The inner node may be shared, so the folded constant
+                    // gets a node of its own
+                    double number = eval_bop(bop.kind, expr_buffer_at(eb, c)->as.number, expr_buffer_at(eb, d)->as.number);
+                    Expr_Index folded = expr_buffer_alloc(eb);
+                    {
+                        Expr *folded_expr = expr_buffer_at(eb, folded);
+                        *folded_expr = *expr_buffer_at(eb, c);
+                        folded_expr->as.number = number;
+                    }
+                    folded = expr_buffer_intern(eb, folded);
+
+                    Expr *expr = expr_buffer_at(eb, index);
+                    expr->as.bop.lhs = folded;
+                    expr->as.bop.rhs = y;
+                }
+            }
+        }
+
+        return index;
+    }
+
+    default:
+        UNREACHABLE("unknown Expression Kind");
+    }
+}
+
+typedef struct {
+    Expr_Index index;
+    // The operands of the node are rewritten and their replacements are
+    // on top of the results
+    bool operands_done;
+    // The amount of the operands of a chain, see expr_reassociate()
+    size_t leaves;
+} Walk_Frame;
+
+// Explicit stack of the passes that rewrite the expressions bottom up,
+// reused between the expressions
+typedef struct {
+    Walk_Frame *frames;
+    size_t count;
+    size_t capacity;
+    Expr_Indices results;
+    Expr_Indices chain;
+} Expr_Walk;
+
+void expr_walk_push(Expr_Walk *walk, Expr_Index index, bool operands_done, size_t leaves)
+{
+    if (walk->count >= walk->capacity) {
+        walk->capacity = walk->capacity == 0 ? 16 : walk->capacity * 2;
+        walk->frames = realloc(walk->frames, sizeof(*walk->frames) * walk->capacity);
+    }
+
+    walk->frames[walk->count++] = (Walk_Frame) {
+        .index = index,
+        .operands_done = operands_done,
+        .leaves = leaves,
+    };
+}
+
+void expr_walk_free(Expr_Walk *walk)
+{
+    free(walk->frames);
+    free(walk->results.items);
+    free(walk->chain.items);
+}
+
+// Folds the expression bottom up. It walks the tree in post-order with
+// an explicit stack instead of recursion, so the long chains the parser
+// builds out of `A1+A2+...` can't overflow the C stack.
+Expr_Index expr_fold(Expr_Buffer *eb, Expr_Index root, bool fast_math, Expr_Walk *walk)
+{
+    walk->count = 0;
+    walk->results.count = 0;
+    expr_walk_push(walk, root, false, 0);
+
+    while (walk->count > 0) {
+        Walk_Frame frame = walk->frames[--walk->count];
+        Expr *expr = expr_buffer_at(eb, frame.index);
+
+        if (!frame.operands_done) {
+            switch (expr->kind) {
+            case EXPR_KIND_NUMBER:
+            case EXPR_KIND_CELL:
+            case EXPR_KIND_SHEET_CELL:
+                expr_indices_push(&walk->results, frame.index);
+                break;
+
+            case EXPR_KIND_UOP:
+                expr_walk_push(walk, frame.index, true, 0);
+                expr_walk_push(walk, expr->as.uop.param, false, 0);
+                break;
+
+            case EXPR_KIND_BOP: {
+                Expr_Bop bop = expr->as.bop;
+                expr_walk_push(walk, frame.index, true, 0);
+                expr_walk_push(walk, bop.rhs, false, 0);
+                expr_walk_push(walk, bop.lhs, false, 0);
+            } break;
+
+            default:
+                UNREACHABLE("unknown Expression Kind");
+            }
+            continue;
+        }
+
+        if (expr->kind == EXPR_KIND_UOP) {
+            expr->as.uop.param = walk->results.items[--walk->results.count];
+        } else {
+            assert(expr->kind == EXPR_KIND_BOP);
+            expr->as.bop.rhs = walk->results.items[--walk->results.count];
+            expr->as.bop.lhs = walk->results.items[--walk->results.count];
+        }
+        expr_indices_push(&walk->results, expr_fold_node(eb, frame.index, fast_math));
+    }
+
+    assert(walk->results.count == 1);
+    return walk->results.items[0];
+}
+
+// Expression cells that fold completely become number cells, so they
+// never take part in the evaluation or the dependency tracking. The rows
+// before `first_row` are already folded.
+void table_fold_constants(Table *table, Expr_Buffer *eb, size_t first_row, bool fast_math)
+{
+    Expr_Walk walk = {0};
+    for (size_t i = first_row * table->cols; i < table->rows * table->cols; ++i) {
+        Cell *cell = &table->cells[i];
+        if (cell->kind != CELL_KIND_EXPR) {
+            continue;
+        }
+
+        Expr_Index index = expr_fold(eb, cell->expr, fast_math, &walk);
+        Expr *expr = expr_buffer_at(eb, index);
+        if (expr->kind == EXPR_KIND_NUMBER) {
+            cell->kind = CELL_KIND_NUMBER;
+            cell->value = value_number(expr->as.number);
+        } else {
+            cell->expr = index;
+        }
+    }
+    expr_walk_free(&walk);
+}
+
+// Reassociation
+//
+// The parser turns `A1+A2+...+A5000` into a chain that leans to the left,
+// so evaluating it recurses as deep as there are terms and every addition
+// waits for the previous one. Reassociation rebuilds maximal `+` and `*`
+// chains as balanced trees, cutting the depth to O(log n) and letting the
+// independent halves overlap. The rounding of the result may change, so
+// it is opt-in.
+//
+// The balanced trees are built from new nodes because the old chain nodes
+// may be shared with other expressions through hash-consing.
+
+Expr_Index expr_build_balanced(Expr_Buffer *eb, Expr root, const Expr_Index *leaves, size_t count)
+{
+    if (count == 1) {
+        return leaves[0];
+    }
+
+    size_t half = count / 2;
+    Expr_Index lhs = expr_build_balanced(eb, root, leaves, half);
+    Expr_Index rhs = expr_build_balanced(eb, root, leaves + half, count - half);
+
+    Expr_Index index = expr_buffer_alloc(eb);
+    {
+        Expr *expr = expr_buffer_at(eb, index);
+        *expr = root;
+        expr->as.bop.lhs = lhs;
+        expr->as.bop.rhs = rhs;
+    }
+    return expr_buffer_intern(eb, index);
+}
+
+bool bop_is_associative(Bop_Kind kind)
+{
+    return kind == BOP_KIND_PLUS || kind == BOP_KIND_MULT;
+}
+
+// Walks the expression in post-order with an explicit stack like
+// expr_fold(). A `+` or `*` node is visited with all the operands of its
+// chain at once, they come back on top of the results from left to
+// right and get rebuilt into a balanced tree.
+Expr_Index expr_reassociate(Expr_Buffer *eb, Expr_Index root, Expr_Walk *walk)
+{
+    walk->count = 0;
+    walk->results.count = 0;
+    expr_walk_push(walk, root, false, 0);
+
+    while (walk->count > 0) {
+        Walk_Frame frame = walk->frames[--walk->count];
+        Expr node = *expr_buffer_at(eb, frame.index);
+
+        if (!frame.operands_done) {
+            switch (node.kind) {
+            case EXPR_KIND_NUMBER:
+            case EXPR_KIND_CELL:
+            case EXPR_KIND_SHEET_CELL:
+                expr_indices_push(&walk->results, frame.index);
+                break;
+
+            case EXPR_KIND_UOP:
+                expr_walk_push(walk, frame.index, true, 0);
+                expr_walk_push(walk, node.as.uop.param, false, 0);
+                break;
+
+            case EXPR_KIND_BOP: {
+                if (!bop_is_associative(node.as.bop.kind)) {
+                    expr_walk_push(walk, frame.index, true, 0);
+                    expr_walk_push(walk, node.as.bop.rhs, false, 0);
+                    expr_walk_push(walk, node.as.bop.lhs, false, 0);
+                    break;
+                }
+
+                // Collect the operands of the chain without recursing
+                // along it. Popping the rhs first pushes them from right
+                // to left, so the leftmost one gets visited first.
+                size_t leaves = 0;
+                size_t frames = walk->count + 1;
+                walk->chain.count = 0;
+                expr_indices_push(&walk->chain, frame.index);
+                expr_walk_push(walk, frame.index, true, 0);
+                while (walk->chain.count > 0) {
+                    Expr_Index top = walk->chain.items[--walk->chain.count];
+                    Expr *expr = expr_buffer_at(eb, top);
+                    if (expr->kind == EXPR_KIND_BOP && expr->as.bop.kind == node.as.bop.kind) {
+                        expr_indices_push(&walk->chain, expr->as.bop.lhs);
+                        expr_indices_push(&walk->chain, expr->as.bop.rhs);
+                    } else {
+                        expr_walk_push(walk, top, false, 0);
+                        leaves += 1;
+                    }
+                }
+                walk->frames[frames - 1].leaves = leaves;
+            } break;
+
+            default:
+                UNREACHABLE("unknown Expression Kind");
+            }
+            continue;
+        }
+
+        Expr_Index result = frame.index;
+        if (node.kind == EXPR_KIND_UOP) {
+            expr_buffer_at(eb, frame.index)->as.uop.param = walk->results.items[--walk->results.count];
+        } else if (!bop_is_associative(node.as.bop.kind)) {
+            Expr *expr = expr_buffer_at(eb, frame.index);
+            expr->as.bop.rhs = walk->results.items[--walk->results.count];
+            expr->as.bop.lhs = walk->results.items[--walk->results.count];
+        } else {
+            walk->results.count -= frame.leaves;
+            result = expr_build_balanced(eb, node, walk->results.items + walk->results.count, frame.leaves);
+        }
+        expr_indices_push(&walk->results, result);
+    }
+
+    assert(walk->results.count == 1);
+    return walk->results.items[0];
+}
+
+// The rows before `first_row` are already reassociated
+void table_reassociate(Table *table, Expr_Buffer *eb, size_t first_row)
+{
+    Expr_Walk walk = {0};
+    for (size_t i = first_row * table->cols; i < table->rows * table->cols; ++i) {
+        Cell *cell = &table->cells[i];
+        if (cell->kind == CELL_KIND_EXPR) {
+            cell->expr = expr_reassociate(eb, cell->expr, &walk);
+        }
+    }
+    expr_walk_free(&walk);
+}
+
+// Dependency analysis
+//
+// Before the evaluation all the clones are resolved, which makes the
+// dependencies of every cell known upfront. The strongly connected
+// components of the dependency graph are then found with an iterative
+// version of Tarjan's algorithm. Every component that has more than one
+// cell, or a single cell referencing itself, is a cycle. All of them are
+// reported and their cells become #CYCLE!, which propagates to the cells
+// downstream during the evaluation. Tarjan's algorithm emits a component
+// only after all the components it depends on, so that is the order the
+// cells get evaluated in, without deep recursion.
+
+void table_report_cycle(Table *table, const size_t *offsets, size_t count)
+{
+    const Cell *first = &table->cells[offsets[0]];
+    fprintf(stderr, "%s:%zu:%zu: ERROR: circular dependency between %zu cell%s\n",
+            table->file_path, offsets[0] / table->cols + 1, first->file_col, count, count == 1 ? "" : "s");
+    for (size_t i = 0; i < count; ++i) {
+        const Cell *cell = &table->cells[offsets[i]];
+        fprintf(stderr, "%s:%zu:%zu: NOTE: %c%zu is part of the cycle\n",
+                table->file_path, offsets[i] / table->cols + 1, cell->file_col,
+                (char) ('A' + offsets[i] % table->cols), offsets[i] / table->cols);
+    }
+}
+
+void table_set_cycle(Table *table, size_t offset)
+{
+    Cell *cell = &table->cells[offset];
+    if (cell->kind == CELL_KIND_EXPR) {
+        cell->value = value_error(ERROR_CYCLE);
+    } else {
+        cell_set_error(cell, ERROR_CYCLE);
+    }
+}
+
+// Marks and reports the cycles found by an earlier analysis of the table
+// again, see Cycle_Log
+void table_replay_cycles(Table *table, const Cycle_Log *cycles)
+{
+    for (size_t i = 0; i < cycles->count; i += cycles->items[i] + 1) {
+        size_t count = cycles->items[i];
+        const size_t *offsets = &cycles->items[i + 1];
+        for (size_t k = 0; k < count; ++k) {
+            table_set_cycle(table, offsets[k]);
+            table->cells[offsets[k]].status = EVALUATED;
+        }
+        table_report_cycle(table, offsets, count);
+    }
+}
+
+// Resolves the clone at `cell_index` and reports the clone cycles and the
+// clones from outside of the table on the way. With `chain` every clone
+// on the way to the cloned cell is resolved as well, each one from its
+// neighbor. Otherwise only the clone at `cell_index` is, straight from
+// the cloned cell, and the clones in between stay as they are. Either way
+// a resolved clone costs O(1), it only points at the source of the
+// expression, see Clone_Site.
+void table_resolve_clone(Table *table, Cell_Index cell_index, Cell_Indices *path, bool chain)
+{
+    // Walk down the chain until a cell that is not a clone
+    path->count = 0;
+    Cell_Index source_index = cell_index;
+    for (;;) {
+        Cell *cell = table_cell_at(table, source_index);
+        if (cell->kind != CELL_KIND_CLONE) {
+            break;
+        }
+
+        if (cell->status == INPROGRESS) {
+            // The chain came back to itself. Everything from that cell
+            // on is the cycle, everything before it clones the cycle.
+            size_t start = 0;
+            while (table_cell_offset(table, path->items[start]) != table_cell_offset(table, source_index)) {
+                start += 1;
+            }
+
+            size_t count = path->count - start;
+            size_t *cycle = malloc(sizeof(*cycle) * count);
+            for (size_t k = 0; k < count; ++k) {
+                cycle[k] = table_cell_offset(table, path->items[start + k]);
+                table_set_cycle(table, cycle[k]);
+                table->cells[cycle[k]].status = UNEVALUATED;
+            }
+            table_report_cycle(table, cycle, count);
+            free(cycle);
+            path->count = start;
+            break;
+        }
+
+        cell->status = INPROGRESS;
+        cell_indices_push(path, source_index);
+
+        Cell_Index nbor_index = nbor_in_dir(source_index, cell->clone_dir);
+        if (table_need_row(table, nbor_index)) {
+            // Resolved once more of the table is parsed
+            for (size_t i = 0; i < path->count; ++i) {
+                table_cell_at(table, path->items[i])->status = UNEVALUATED;
+            }
+            path->count = 0;
+            return;
+        }
+        if (!table_contains(table, nbor_index)) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: trying to clone a cell outside of the table\n", table->file_path, source_index.row + 1, cell->file_col);
+            cell_set_error(cell, ERROR_REF);
+            cell->status = UNEVALUATED;
+            path->count -= 1;
+            break;
+        }
+        source_index = nbor_index;
+    }
+
+    if (!chain) {
+        for (size_t i = 0; i < path->count; ++i) {
+            table_cell_at(table, path->items[i])->status = UNEVALUATED;
+        }
+        if (path->count == 0) {
+            // The clone itself turned out to be a cycle or a #REF!
+            return;
+        }
+        path->count = 1;
+    }
+
+    // Resolve the chain from its end
+    while (path->count > 0) {
+        Cell_Index clone_index = path->items[--path->count];
+        Cell *cell = table_cell_at(table, clone_index);
+        Cell_Index from_index = chain ? nbor_in_dir(clone_index, cell->clone_dir) : source_index;
+        Cell *from = table_cell_at(table, from_index);
+
+        cell->kind = from->kind;
+        cell->value = from->value;
+        cell->expr = from->expr;
+        cell->source = from->cloned ? from->source : table_cell_offset(table, from_index);
+        cell->status = UNEVALUATED;
+    }
+}
+
+// Turns every clone into a copy of the cell it clones, following the
+// chains of clones without recursion
+void table_resolve_clones(Table *table)
+{
+    Cell_Indices path = {0};
+    for (size_t i = 0; i < table->rows * table->cols; ++i) {
+        if (table->cells[i].kind == CELL_KIND_CLONE) {
+            Cell_Index cell_index = {
+                .row = i / table->cols,
+                .col = i % table->cols,
+            };
+            table_resolve_clone(table, cell_index, &path, true);
+        }
+    }
+    free(path.items);
+}
+
+// The dependency graph the analysis runs on. The node `k` is the cell at
+// the offset nodes[k], or simply the cell `k` if nodes is NULL. The
+// precedents of the node `k` are edges[edges_start[k]..edges_start[k + 1]].
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t *nodes;
+    size_t *edges_start;
+    size_t *edges;
+    size_t edges_count;
+    size_t edges_capacity;
+} Dep_Graph;
+
+void dep_graph_push_edge(Dep_Graph *graph, size_t node)
+{
+    if (graph->edges_count >= graph->edges_capacity) {
+        graph->edges_capacity = graph->edges_capacity == 0 ? 1024 : graph->edges_capacity * 2;
+        graph->edges = realloc(graph->edges, sizeof(*graph->edges) * graph->edges_capacity);
+    }
+    graph->edges[graph->edges_count++] = node;
+}
+
+// Returns the new node
+size_t dep_graph_push_node(Dep_Graph *graph, size_t offset)
+{
+    // One more for the end of the edges of the last node
+    if (graph->count + 1 >= graph->capacity) {
+        graph->capacity = graph->capacity == 0 ? 256 : graph->capacity * 2;
+        graph->nodes = realloc(graph->nodes, sizeof(*graph->nodes) * graph->capacity);
+        graph->edges_start = realloc(graph->edges_start, sizeof(*graph->edges_start) * graph->capacity);
+    }
+    graph->nodes[graph->count] = offset;
+    return graph->count++;
+}
+
+size_t dep_graph_offset(const Dep_Graph *graph, size_t node)
+{
+    return graph->nodes ? graph->nodes[node] : node;
+}
+
+void dep_graph_free(Dep_Graph *graph)
+{
+    free(graph->nodes);
+    free(graph->edges_start);
+    free(graph->edges);
+}
+
+// The graph of the whole table. The clones must be resolved.
+void table_build_graph(Table *table, Expr_Buffer *eb, Dep_Graph *graph)
+{
+    size_t n = table->rows * table->cols;
+    graph->count = n;
+    graph->edges_start = malloc(sizeof(*graph->edges_start) * (n + 1));
+    for (size_t i = 0; i < n; ++i) {
+        graph->edges_start[i] = graph->edges_count;
+        if (table->cells[i].kind != CELL_KIND_EXPR) {
+            continue;
+        }
+
+        Cell_Index cell_index = {
+            .row = i / table->cols,
+            .col = i % table->cols,
+        };
+        table->precedents.count = 0;
+        table_collect_expr_cells(table, eb, cell_index);
+        for (size_t j = 0; j < table->precedents.count; ++j) {
+            if (table_contains(table, table->precedents.items[j])) {
+                dep_graph_push_edge(graph, table_cell_offset(table, table->precedents.items[j]));
+            }
+        }
+    }
+    graph->edges_start[n] = graph->edges_count;
+}
+
+// The graph of the `roots` and everything they transitively depend on.
+// Only the clones that end up in it get resolved.
+void table_build_cone(Table *table, Expr_Buffer *eb, const Cell_Indices *roots, Dep_Graph *graph)
+{
+    // The node of the cell plus one, zero for the cells outside of the cone
+    size_t *nodes_of = calloc(table->rows * table->cols, sizeof(*nodes_of));
+    Cell_Indices path = {0};
+
+    for (size_t i = 0; i < roots->count; ++i) {
+        size_t offset = table_cell_offset(table, roots->items[i]);
+        if (nodes_of[offset] == 0) {
+            nodes_of[offset] = dep_graph_push_node(graph, offset) + 1;
+        }
+    }
+
+    // The nodes are visited in the order they are discovered, so the
+    // edges of every node end up next to each other
+    for (size_t k = 0; k < graph->count; ++k) {
+        size_t offset = graph->nodes[k];
+        Cell_Index cell_index = {
+            .row = offset / table->cols,
+            .col = offset % table->cols,
+        };
+        Cell *cell = &table->cells[offset];
+        if (cell->kind == CELL_KIND_CLONE) {
+            table_resolve_clone(table, cell_index, &path, false);
+        }
+
+        graph->edges_start[k] = graph->edges_count;
+        if (cell->kind != CELL_KIND_EXPR) {
+            continue;
+        }
+
+        table->precedents.count = 0;
+        table_collect_expr_cells(table, eb, cell_index);
+        for (size_t j = 0; j < table->precedents.count; ++j) {
+            Cell_Index precedent = table->precedents.items[j];
+            if (!table_contains(table, precedent)) {
+                table_need_row(table, precedent);
+                continue;
+            }
+
+            size_t precedent_offset = table_cell_offset(table, precedent);
+            if (nodes_of[precedent_offset] == 0) {
+                nodes_of[precedent_offset] = dep_graph_push_node(graph, precedent_offset) + 1;
+            }
+            dep_graph_push_edge(graph, nodes_of[precedent_offset] - 1);
+        }
+    }
+    if (graph->edges_start != NULL) {
+        graph->edges_start[graph->count] = graph->edges_count;
+    }
+
+    free(nodes_of);
+    free(path.items);
+}
+
+typedef struct {
+    size_t node;
+    size_t next_edge;
+} Tarjan_Frame;
+
+// Finds the evaluation order of the cells of the graph into `order`
+// (offsets of the cells) and reports the cycles
+void table_analyze_dependencies(Table *table, const Dep_Graph *graph, size_t *order)
+{
+    size_t n = graph->count;
+    const size_t *edges_start = graph->edges_start;
+    const size_t *edges = graph->edges;
+
+    // Visited nodes are numbered from 1, so the zeroed memory means
+    // "unvisited"
+    const size_t unvisited = 0;
+    size_t *index = calloc(n, sizeof(*index));
+    size_t *lowlink = malloc(sizeof(*lowlink) * n);
+    bool *on_stack = calloc(n, sizeof(*on_stack));
+    size_t *stack = NULL;
+    size_t stack_count = 0;
+    Tarjan_Frame *frames = NULL;
+    size_t frames_count = 0;
+    size_t order_count = 0;
+    size_t counter = 1;
+
+    // Depth of the search never exceeds the amount of the cells that have
+    // precedents plus one
+    size_t depth_bound = 1;
+    for (size_t i = 0; i < n; ++i) {
+        depth_bound += edges_start[i] != edges_start[i + 1];
+    }
+    stack = malloc(sizeof(*stack) * depth_bound);
+    frames = malloc(sizeof(*frames) * depth_bound);
+
+    for (size_t root = 0; root < n; ++root) {
+        if (index[root] != unvisited) {
+            continue;
+        }
+
+        // Most of the cells don't depend on anything
+        if (edges_start[root] == edges_start[root + 1]) {
+            index[root] = counter++;
+            order[order_count++] = dep_graph_offset(graph, root);
+            continue;
+        }
+
+        index[root] = lowlink[root] = counter++;
+        stack[stack_count++] = root;
+        on_stack[root] = true;
+        frames[frames_count++] = (Tarjan_Frame) {
+            .node = root,
+            .next_edge = edges_start[root],
+        };
+
+        while (frames_count > 0) {
+            Tarjan_Frame *frame = &frames[frames_count - 1];
+            size_t v = frame->node;
+
+            if (frame->next_edge < edges_start[v + 1]) {
+                size_t w = edges[frame->next_edge++];
+                if (index[w] == unvisited) {
+                    index[w] = lowlink[w] = counter++;
+                    stack[stack_count++] = w;
+                    on_stack[w] = true;
+                    frames[frames_count++] = (Tarjan_Frame) {
+                        .node = w,
+                        .next_edge = edges_start[w],
+                    };
+                } else if (on_stack[w] && lowlink[v] > index[w]) {
+                    lowlink[v] = index[w];
+                }
+                continue;
+            }
+
+            frames_count -= 1;
+            if (lowlink[v] == index[v]) {
+                // v is the root of a component, it's on the stack with
+                // all of its members above it
+                size_t component = order_count;
+                size_t w = 0;
+                do {
+                    w = stack[--stack_count];
+                    on_stack[w] = false;
+                    order[order_count++] = w;
+                } while (w != v);
+
+                size_t count = order_count - component;
+                bool self_loop = false;
+                for (size_t e = edges_start[v]; count == 1 && e < edges_start[v + 1]; ++e) {
+                    self_loop = self_loop || edges[e] == v;
+                }
+
+                for (size_t k = component; k < order_count; ++k) {
+                    order[k] = dep_graph_offset(graph, order[k]);
+                }
+
+                // A cycle evaluated on demand before is already reported,
+                // see workbook_eval_cell()
+                bool reported = table->cells[order[component]].status == EVALUATED;
+                if ((count > 1 || self_loop) && !reported) {
+                    for (size_t k = component; k < order_count; ++k) {
+                        table_set_cycle(table, order[k]);
+                        Cell *cell = &table->cells[order[k]];
+                        table_mark_evaluated(table, cell, (Cell_Index) {
+                            .row = order[k] / table->cols,
+                            .col = order[k] % table->cols,
+                        });
+                    }
+                    table_report_cycle(table, order + component, count);
+                    if (table->cycles) {
+                        cycle_log_push(table->cycles, count);
+                        for (size_t k = component; k < order_count; ++k) {
+                            cycle_log_push(table->cycles, order[k]);
+                        }
+                    }
+                }
+            }
+
+            if (frames_count > 0) {
+                size_t parent = frames[frames_count - 1].node;
+                if (lowlink[parent] > lowlink[v]) {
+                    lowlink[parent] = lowlink[v];
+                }
+            }
+        }
+    }
+    assert(order_count == n);
+
+    free(index);
+    free(lowlink);
+    free(on_stack);
+    free(stack);
+    free(frames);
+}
+
+// Cells per "eval chunk" span in the trace
+#define TRACE_EVAL_CHUNK_CELLS (64 * 1024)
+
+// Evaluates the cells in the order found by table_analyze_dependencies()
+void table_eval_order(Table *table, Expr_Buffer *eb, const size_t *order, size_t count)
+{
+    expr_buffer_begin_pass(eb);
+    double chunk_begin_secs = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        if (tracer && i % TRACE_EVAL_CHUNK_CELLS == 0) {
+            chunk_begin_secs = clock_wall_secs();
+        }
+
+        // A cell evaluated on demand may depend on a cell that is waiting
+        // for it further up the stack, the cell is finished there
+        if (table->cells[order[i]].status == INPROGRESS) {
+            continue;
+        }
+        Cell_Index cell_index = {
+            .row = order[i] / table->cols,
+            .col = order[i] % table->cols,
+        };
+        table_eval_cell(table, eb, cell_index);
+
+        if (tracer && ((i + 1) % TRACE_EVAL_CHUNK_CELLS == 0 || i + 1 == count)) {
+            trace_span_range("eval", "eval chunk", chunk_begin_secs, clock_wall_secs(),
+                             i - i % TRACE_EVAL_CHUNK_CELLS, i);
+        }
+    }
+}
+
+void table_eval_all(Table *table, Expr_Buffer *eb)
+{
+    table_resolve_clones(table);
+
+    Dep_Graph graph = {0};
+    table_build_graph(table, eb, &graph);
+    size_t *order = malloc(sizeof(*order) * graph.count);
+    table_analyze_dependencies(table, &graph, order);
+    table_eval_order(table, eb, order, graph.count);
+
+    free(order);
+    dep_graph_free(&graph);
+}
+
+// Evaluates only the `cells` and what they depend on. The rest of the
+// table is left unevaluated, including the clones. Returns false without
+// evaluating anything if a partial table turns out to be too short, see
+// Table::partial. It has to be parsed again with at least rows_needed
+// rows then.
+bool table_eval_cells(Table *table, Expr_Buffer *eb, const Cell_Indices *cells)
+{
+    Dep_Graph graph = {0};
+    table->rows_needed = 0;
+    table_build_cone(table, eb, cells, &graph);
+    if (table->rows_needed > 0) {
+        dep_graph_free(&graph);
+        return false;
+    }
+
+    size_t *order = malloc(sizeof(*order) * graph.count);
+    table_analyze_dependencies(table, &graph, order);
+    table_eval_order(table, eb, order, graph.count);
+
+    free(order);
+    dep_graph_free(&graph);
+    return true;
+}
+
+void table_recalc(Table *table, Expr_Buffer *eb)
+{
+    Cell_Indices *dirty = &table->changed;
+    size_t changed_count = dirty->count;
+
+    // Extend the changed cells with all of their transitive dependents
+    for (size_t i = 0; i < dirty->count; ++i) {
+        Cell_Indices *deps = &table->dependents[table_cell_offset(table, dirty->items[i])];
+        for (size_t j = 0; j < deps->count; ++j) {
+            size_t offset = table_cell_offset(table, deps->items[j]);
+            if (!table->dirty[offset]) {
+                table->dirty[offset] = true;
+                cell_indices_push(dirty, deps->items[j]);
+            }
+        }
+    }
+
+    // Dirty clones must be resolved again since the cell they clone may
+    // have changed its expression
+    for (size_t i = 0; i < dirty->count; ++i) {
+        Cell *cell = table_cell_at(table, dirty->items[i]);
+        if (i >= changed_count && cell->cloned) {
+            table_unlink_cell(table, eb, dirty->items[i]);
+            cell->kind = CELL_KIND_CLONE;
+        }
+        cell->status = UNEVALUATED;
+    }
+
+    // Resolving a clone while it's evaluated would evaluate the cell it
+    // clones first, and that cell may well depend on the clone
+    Cell_Indices path = {0};
+    for (size_t i = 0; i < dirty->count; ++i) {
+        if (table_cell_at(table, dirty->items[i])->kind == CELL_KIND_CLONE) {
+            table_resolve_clone(table, dirty->items[i], &path, true);
+        }
+    }
+    free(path.items);
+
+    // The dirty cells depend only on each other and on the cells that are
+    // evaluated already. They are analyzed like the whole table is on the
+    // first evaluation, so the same cells end up in the cycles.
+    Dep_Graph graph = {0};
+    for (size_t i = 0; i < dirty->count; ++i) {
+        size_t offset = table_cell_offset(table, dirty->items[i]);
+        table->dirty_node[offset] = dep_graph_push_node(&graph, offset) + 1;
+    }
+    for (size_t k = 0; k < graph.count; ++k) {
+        graph.edges_start[k] = graph.edges_count;
+        if (table->cells[graph.nodes[k]].kind != CELL_KIND_EXPR) {
+            continue;
+        }
+
+        table->precedents.count = 0;
+        table_collect_expr_cells(table, eb, dirty->items[k]);
+        for (size_t j = 0; j < table->precedents.count; ++j) {
+            Cell_Index precedent = table->precedents.items[j];
+            if (!table_contains(table, precedent)) {
+                continue;
+            }
+            size_t node = table->dirty_node[table_cell_offset(table, precedent)];
+            if (node > 0) {
+                dep_graph_push_edge(&graph, node - 1);
+            }
+        }
+    }
+    if (graph.edges_start != NULL) {
+        graph.edges_start[graph.count] = graph.edges_count;
+    }
+
+    size_t *order = malloc(sizeof(*order) * graph.count);
+    table_analyze_dependencies(table, &graph, order);
+    table_eval_order(table, eb, order, graph.count);
+    free(order);
+    dep_graph_free(&graph);
+
+    for (size_t i = 0; i < dirty->count; ++i) {
+        Cell *cell = table_cell_at(table, dirty->items[i]);
+        if (i < changed_count || cell->cloned) {
+            table_link_cell(table, eb, dirty->items[i]);
+        }
+        size_t offset = table_cell_offset(table, dirty->items[i]);
+        table->dirty[offset] = false;
+        table->dirty_node[offset] = 0;
+    }
+
+    dirty->count = 0;
+}
+
+int fprint_value(FILE *stream, const Table *table, Value value)
+{
+    switch (value_type(value)) {
+    case VALUE_NUMBER:
+        return fprintf(stream, "%lf", value.number);
+    case VALUE_TEXT: {
+        String_View text = table_text(table, value);
+        return fprintf(stream, SV_Fmt, SV_Arg(text));
+    }
+    case VALUE_ERROR:
+        return fprintf(stream, "%s", error_kind_as_cstr(value_error_kind(value)));
+    case VALUE_EMPTY:
+        return 0;
+    default:
+        UNREACHABLE("unknown Value Type");
+    }
+}
+
+size_t value_width(const Table *table, Value value)
+{
+    switch (value_type(value)) {
+    case VALUE_NUMBER: {
+        int n = snprintf(NULL, 0, "%lf", value.number);
+        assert(n >= 0);
+        return (size_t) n;
+    }
+    case VALUE_TEXT:
+        return table_text(table, value).count;
+    case VALUE_ERROR:
+        return strlen(error_kind_as_cstr(value_error_kind(value)));
+    case VALUE_EMPTY:
+        return 0;
+    default:
+        UNREACHABLE("unknown Value Type");
+    }
+}
+
+int fprint_cell(FILE *stream, const Table *table, const Cell *cell)
+{
+    return fprint_value(stream, table, cell_value(cell));
+}
+
+size_t cell_width(const Table *table, const Cell *cell)
+{
+    return value_width(table, cell_value(cell));
+}
+
+// Renders the `rows` x `cols` part of the table. NULL `rows` or `cols`
+// stand for the first `rows_count` or `cols_count` of them.
+void table_render_part(Table *table, const size_t *rows, size_t rows_count, const size_t *cols, size_t cols_count, FILE *stream)
+{
+    // Estimate column widths
+    stats_begin();
+    size_t *col_widths = malloc(sizeof(size_t) * cols_count);
+    {
+        for (size_t j = 0; j < cols_count; ++j) {
+            col_widths[j] = 0;
+            for (size_t i = 0; i < rows_count; ++i) {
+                Cell_Index cell_index = {
+                    .row = rows ? rows[i] : i,
+                    .col = cols ? cols[j] : j,
+                };
+
+                size_t width = cell_width(table, table_cell_at(table, cell_index));
+                if (col_widths[j] < width) {
+                    col_widths[j] = width;
+                }
+            }
+        }
+    }
+
+    stats_end(PHASE_WIDTHS);
+
+    // Render the table
+    stats_begin();
+    for (size_t i = 0; i < rows_count; ++i) {
+        for (size_t j = 0; j < cols_count; ++j) {
+            Cell_Index cell_index = {
+                .row = rows ? rows[i] : i,
+                .col = cols ? cols[j] : j,
+            };
+
+            int n = fprint_cell(stream, table, table_cell_at(table, cell_index));
+            assert(0 <= n);
+            assert((size_t) n <= col_widths[j]);
+            fprintf(stream, "%*s", (int) (col_widths[j] - n), "");
+
+            if (j < cols_count - 1) {
+                fprintf(stream, "|");
+            }
+        }
+        fprintf(stream, "\n");
+    }
+    stats_end(PHASE_RENDER);
+
+    free(col_widths);
+}
+
+void table_render(Table *table, FILE *stream)
+{
+    table_render_part(table, NULL, table->rows, NULL, table->cols, stream);
+}
+
+// Parses the rows of `input` the table doesn't have yet. The rows it
+// already has must come from the beginning of the same `input`, they are
+// kept as they are (--head). If the new rows are wider, the old ones get
+// empty cells to the right like they would on a single parse.
+void table_parse_content(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, String_View input)
+{
+    size_t parsed_rows = table->rows;
+    size_t parsed_cols = table->cols;
+
+    stats_begin();
+    estimate_table_size(input, &table->rows, &table->cols);
+    assert(table->rows >= parsed_rows && table->cols >= parsed_cols);
+    stats_end(PHASE_ESTIMATE);
+
+    stats_begin();
+    Cell *cells = malloc(sizeof(*cells) * table->rows * table->cols);
+    memset(cells, 0, sizeof(*cells) * table->rows * table->cols);
+    for (size_t row = 0; row < parsed_rows; ++row) {
+        memcpy(&cells[row * table->cols], &table->cells[row * parsed_cols], sizeof(*cells) * parsed_cols);
+    }
+    free(table->cells);
+    table->cells = cells;
+    parse_table_from_content(table, eb, tc, input, parsed_rows, parsed_cols);
+    stats_end(PHASE_PARSE);
+}
+
+// Reads, parses and evaluates the table from `file_path`. On success the
+// table keeps views into the returned content.
+char *table_load_from_file(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, const char *file_path, size_t *size)
+{
+    size_t content_size = 0;
+    char *content = slurp_file(file_path, &content_size);
+    if (content == NULL) {
+        fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                file_path, strerror(errno));
+        return NULL;
+    }
+
+    String_View input = {
+        .count = content_size,
+        .data = content,
+    };
+
+    table->file_path = file_path;
+    table_parse_content(table, eb, tc, input);
+    table_fold_constants(table, eb, 0, false);
+    table_eval_all(table, eb);
+
+    if (size) {
+        *size = content_size;
+    }
+
+    return content;
+}
+
+// Loads the sheet and the sheets it refers to, evaluating every one of
+// them after the ones it refers to. It goes depth first with an explicit
+// stack instead of recursion, so a long chain of sheets can't overflow
+// the C stack. The sheets that are still on the stack are left to be
+// evaluated on demand, see workbook_eval_cell().
+void workbook_load(size_t index)
+{
+    typedef struct {
+        size_t sheet;
+        // The next node of the expression buffer of the sheet to look
+        // for the references to the other sheets in
+        size_t next;
+    } Frame;
+
+    // The phases of the sheets are counted on their own, don't let them
+    // reset the start of the phase that is loading them
+    double wall_start = stats.wall_start;
+    double cpu_start = stats.cpu_start;
+
+    size_t count = 0;
+    size_t capacity = 16;
+    Frame *stack = malloc(sizeof(*stack) * capacity);
+    stack[count++] = (Frame) {.sheet = index};
+
+    while (count > 0) {
+        Frame *top = &stack[count - 1];
+        Book_Sheet *sheet = workbook.items[top->sheet];
+
+        if (sheet->status == BOOK_SHEET_UNLOADED) {
+            sheet->content = file_map(sheet->file_path, &sheet->content_size);
+            sheet->mapped = sheet->content != NULL;
+            if (sheet->content == NULL) {
+                sheet->content = slurp_file(sheet->file_path, &sheet->content_size);
+            }
+            if (sheet->content == NULL) {
+                fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                        sheet->file_path, strerror(errno));
+                sheet->status = BOOK_SHEET_FAILED;
+                count -= 1;
+                continue;
+            }
+
+            String_View input = {
+                .count = sheet->content_size,
+                .data = sheet->content,
+            };
+            sheet->status = BOOK_SHEET_LOADING;
+            sheet->table->file_path = sheet->file_path;
+            table_parse_content(sheet->table, sheet->eb, &workbook.tc, input);
+            table_fold_constants(sheet->table, sheet->eb, 0, false);
+        }
+
+        size_t dep = workbook.count;
+        while (dep == workbook.count && top->next < sheet->eb->count) {
+            const Expr *expr = &sheet->eb->items[top->next++];
+            if (expr->kind == EXPR_KIND_SHEET_CELL &&
+                workbook.items[expr->as.sheet_cell.sheet]->status == BOOK_SHEET_UNLOADED) {
+                dep = expr->as.sheet_cell.sheet;
+            }
+        }
+
+        if (dep < workbook.count) {
+            if (count >= capacity) {
+                capacity *= 2;
+                stack = realloc(stack, sizeof(*stack) * capacity);
+            }
+            stack[count++] = (Frame) {.sheet = dep};
+            continue;
+        }
+
+        table_eval_all(sheet->table, sheet->eb);
+        sheet->status = BOOK_SHEET_EVALUATED;
+        count -= 1;
+    }
+
+    free(stack);
+    stats.wall_start = wall_start;
+    stats.cpu_start = cpu_start;
+}
+
+// Every cell evaluated on demand goes through the C stack of the cell that
+// refers to it. The sheets referring back and forth deeper than that
+// make the reference #REF! rather than overflow it.
+#define WORKBOOK_MAX_DEPTH 256
+
+// The value of the cell of the other sheet, loading the sheet on the
+// first reference to it. Reports the problems unless `report` is false.
+double workbook_eval_cell(const Expr *expr, const Clone_Site *clone, bool report)
+{
+    size_t index = expr->as.sheet_cell.sheet;
+    if (workbook.items[index]->status == BOOK_SHEET_UNLOADED) {
+        workbook_load(index);
+    }
+
+    Book_Sheet *sheet = workbook.items[index];
+    switch (sheet->status) {
+    case BOOK_SHEET_EVALUATED:
+    case BOOK_SHEET_LOADING:
+        break;
+    case BOOK_SHEET_FAILED:
+        if (report) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: could not load the sheet %s\n",
+                    expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone), sheet->file_path);
+        }
+        return error_number(ERROR_REF);
+    case BOOK_SHEET_UNLOADED:
+    default:
+        UNREACHABLE("unknown Book Sheet Status");
+    }
+
+    Cell_Index cell_index = clone_move(clone, expr->as.sheet_cell.cell);
+    if (!table_contains(sheet->table, cell_index)) {
+        if (report) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: cell reference outside of the sheet %s\n",
+                    expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone), sheet->file_path);
+        }
+        return error_number(ERROR_REF);
+    }
+
+    const Cell *target_cell = table_cell_at(sheet->table, cell_index);
+    if (target_cell->status == INPROGRESS) {
+        if (report) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: circular dependency between sheets\n",
+                    expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+            fprintf(stderr, "%s:%zu:%zu: NOTE: %c%zu is part of the cycle\n",
+                    sheet->file_path, cell_index.row + 1, target_cell->file_col,
+                    (char) ('A' + cell_index.col), cell_index.row);
+        }
+        return error_number(ERROR_CYCLE);
+    }
+    if (target_cell->status == UNEVALUATED && workbook.depth >= WORKBOOK_MAX_DEPTH) {
+        if (report) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: the sheets refer back and forth more than %d times\n",
+                    expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone), WORKBOOK_MAX_DEPTH);
+        }
+        return error_number(ERROR_REF);
+    }
+    if (target_cell->status == UNEVALUATED) {
+        workbook.depth += 1;
+        Cell_Indices cells = {0};
+        cell_indices_push(&cells, cell_index);
+        bool evaluated = table_eval_cells(sheet->table, sheet->eb, &cells);
+        assert(evaluated && "the other sheets are parsed completely");
+        (void) evaluated;
+        free(cells.items);
+        workbook.depth -= 1;
+        // The clone may have become another cell
+        target_cell = table_cell_at(sheet->table, cell_index);
+    }
+    Value value = cell_value(target_cell);
+    switch (value_type(value)) {
+    case VALUE_NUMBER:
+    case VALUE_ERROR:
+        return value.number;
+    case VALUE_TEXT:
+    case VALUE_EMPTY:
+        if (report) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: text cells may not participate in math expressions\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+            fprintf(stderr, "%s:%zu:%zu: NOTE: the text cell is located here\n",
+                    sheet->file_path, cell_index.row + 1, target_cell->file_col);
+        }
+        return error_number(ERROR_VALUE);
+    default:
+        UNREACHABLE("unknown Value Type");
+    }
+}
+
+void workbook_free(void)
+{
+    for (size_t i = 0; i < workbook.count; ++i) {
+        Book_Sheet *sheet = workbook.items[i];
+        if (!sheet->root) {
+            table_free(sheet->table);
+            expr_buffer_free(sheet->eb);
+            free(sheet->table);
+            free(sheet->eb);
+        }
+        if (sheet->mapped) {
+            file_unmap(sheet->content, sheet->content_size);
+        } else {
+            free(sheet->content);
+        }
+        free(sheet->file_path);
+        free(sheet);
+    }
+    free(workbook.items);
+    free(workbook.slots);
+    free(workbook.tc.cstr);
+    free(workbook.path.cstr);
+    memset(&workbook, 0, sizeof(workbook));
+}
+
+// Compiled sheet cache
+//
+// `--cache <file>` stores the parsed table next to the content hash of
+// the input. The cells are stored after the evaluation, so the clones are
+// already resolved, together with the whole expression buffer and the
+// order the cells were evaluated in. A later run on the same content maps
+// the cache and evaluates the cells in that order without lexing, parsing
+// or resolving any clones. The cycles the analysis reported are stored as
+// well, so they are reported the same way without analyzing the table
+// again.
+//
+// The format is the native byte order of the machine that wrote it.
+// A cache from a machine with a different one fails the magic check and
+// is simply rebuilt.
+
+#define CACHE_MAGIC 0x4C45434D // "MCEL" in little endian
+#define CACHE_VERSION 4
+
+// The optimizations rewrite the stored expressions, so a cache is only
+// valid for the options it was built with
+#define CACHE_OPTION_FAST_MATH  (1 << 0)
+#define CACHE_OPTION_REASSOCIATE (1 << 1)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t options;
+    uint64_t content_hash;
+    uint64_t content_size;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t exprs_count;
+    uint64_t order_count;
+    uint64_t cycles_count;
+} Cache_Header;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t cloned;
+    uint8_t clone_dir;
+    uint8_t padding[5];
+    union {
+        double number;
+        uint64_t text_offset;
+        uint64_t expr_index;
+    } as;
+    uint64_t text_count;
+    uint64_t source;
+    uint64_t file_col;
+} Cache_Cell;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t op;
+    uint8_t padding[6];
+    union {
+        double number;
+        uint64_t cell[2];
+        uint64_t bop[2];
+        uint64_t uop;
+    } as;
+    uint64_t file_row;
+    uint64_t file_col;
+} Cache_Expr;
+
+bool cache_write(const char *cache_path, Table *table, Expr_Buffer *eb, Cell_Indices *order, Cycle_Log *cycles, String_View content, uint64_t options)
+{
+    // Write into a temporary file first so a concurrent run never sees a
+    // half written cache
+    size_t tmp_path_size = strlen(cache_path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_path_size);
+    snprintf(tmp_path, tmp_path_size, "%s.tmp", cache_path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        goto error;
+    }
+
+    Cache_Header header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .options = options,
+        .content_hash = fnv1a(content),
+        .content_size = content.count,
+        .rows = table->rows,
+        .cols = table->cols,
+        .exprs_count = eb->count,
+        .order_count = order->count,
+        .cycles_count = cycles->count,
+    };
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (size_t i = 0; i < table->rows * table->cols; ++i) {
+        Cell *cell = &table->cells[i];
+        Cache_Cell record = {
+            .kind = cell->kind,
+            .cloned = cell->cloned,
+            .clone_dir = cell->clone_dir,
+            .source = cell->source,
+            .file_col = cell->file_col,
+        };
+
+        switch (cell->kind) {
+        case CELL_KIND_TEXT:
+            if (value_type(cell->value) == VALUE_TEXT) {
+                String_View text = table_text(table, cell->value);
+                record.as.text_offset = text.data - content.data;
+                record.text_count = text.count;
+            }
+            break;
+        case CELL_KIND_NUMBER:
+            record.as.number = cell->value.number;
+            break;
+        case CELL_KIND_EXPR:
+            record.as.expr_index = cell->expr;
+            break;
+        case CELL_KIND_CLONE:
+            UNREACHABLE("cell should never be a clone after the evaluation");
+        default:
+            UNREACHABLE("unknown Cell Kind");
+        }
+
+        fwrite(&record, sizeof(record), 1, f);
+    }
+
+    for (size_t i = 0; i < eb->count; ++i) {
+        Expr *expr = &eb->items[i];
+        Cache_Expr record = {
+            .kind = expr->kind,
+            .file_row = expr->file_row,
+            .file_col = expr->file_col,
+        };
+
+        switch (expr->kind) {
+        case EXPR_KIND_NUMBER:
+            record.as.number = expr->as.number;
+            break;
+        case EXPR_KIND_CELL:
+            record.as.cell[0] = expr->as.cell.row;
+            record.as.cell[1] = expr->as.cell.col;
+            break;
+        case EXPR_KIND_BOP:
+            record.op = expr->as.bop.kind;
+            record.as.bop[0] = expr->as.bop.lhs;
+            record.as.bop[1] = expr->as.bop.rhs;
+            break;
+        case EXPR_KIND_UOP:
+            record.op = expr->as.uop.kind;
+            record.as.uop = expr->as.uop.param;
+            break;
+        case EXPR_KIND_SHEET_CELL:
+            UNREACHABLE("the sheets referring to other sheets are not cached");
+        default:
+            UNREACHABLE("unknown Expression Kind");
+        }
+
+        fwrite(&record, sizeof(record), 1, f);
+    }
+
+    for (size_t i = 0; i < order->count; ++i) {
+        uint64_t offset = table_cell_offset(table, order->items[i]);
+        fwrite(&offset, sizeof(offset), 1, f);
+    }
+
+    for (size_t i = 0; i < cycles->count; ++i) {
+        uint64_t item = cycles->items[i];
+        fwrite(&item, sizeof(item), 1, f);
+    }
+
+    if (ferror(f)) {
+        goto error;
+    }
+    fclose(f);
+    f = NULL;
+
+    if (rename(tmp_path, cache_path) < 0) {
+        goto error;
+    }
+
+    free(tmp_path);
+    return true;
+
+error:
+    fprintf(stderr, "WARNING: could not write cache %s: %s\n", cache_path, strerror(errno));
+    if (f) {
+        fclose(f);
+    }
+    remove(tmp_path);
+    free(tmp_path);
+    return false;
+}
+
+// Takes `count` records of `size` bytes off the `remaining` bytes of the
+// cache. Fails instead of overflowing.
+bool cache_take(size_t *remaining, uint64_t count, size_t size)
+{
+    if (count > *remaining / size) {
+        return false;
+    }
+    *remaining -= count * size;
+    return true;
+}
+
+typedef struct {
+    uint64_t expr;
+    uint64_t next_operand;
+} Cache_Frame;
+
+// The expressions evaluate recursively, an expression that turns out to
+// be its own operand would never finish. The operands are not always
+// appended before the operation, --reassociate rewrites the trees in
+// place, so this is a depth first search for a loop.
+bool cache_exprs_acyclic(const Cache_Expr *exprs, uint64_t count)
+{
+    enum { UNVISITED = 0, ON_PATH, DONE };
+    uint8_t *state = calloc(count, sizeof(*state));
+    Cache_Frame *frames = malloc(sizeof(*frames) * count);
+    size_t frames_count = 0;
+    bool acyclic = true;
+
+    for (uint64_t root = 0; acyclic && root < count; ++root) {
+        if (state[root] != UNVISITED) {
+            continue;
+        }
+        state[root] = ON_PATH;
+        frames[frames_count++] = (Cache_Frame) { .expr = root };
+
+        while (acyclic && frames_count > 0) {
+            Cache_Frame *frame = &frames[frames_count - 1];
+            const Cache_Expr *expr = &exprs[frame->expr];
+            uint64_t operands = expr->kind == EXPR_KIND_BOP ? 2 : expr->kind == EXPR_KIND_UOP ? 1 : 0;
+            if (frame->next_operand == operands) {
+                state[frame->expr] = DONE;
+                frames_count -= 1;
+                continue;
+            }
+
+            uint64_t operand = expr->kind == EXPR_KIND_BOP
+                ? expr->as.bop[frame->next_operand]
+                : expr->as.uop;
+            frame->next_operand += 1;
+            if (state[operand] == ON_PATH) {
+                acyclic = false;
+            } else if (state[operand] == UNVISITED) {
+                state[operand] = ON_PATH;
+                frames[frames_count++] = (Cache_Frame) { .expr = operand };
+            }
+        }
+    }
+
+    free(state);
+    free(frames);
+    return acyclic;
+}
+
+// Checks every record of the cache against the header and the content
+// before any of them is loaded, so a corrupted cache is rebuilt rather
+// than crashing the evaluation
+bool cache_validate(const Cache_Header *header, const Cache_Cell *cells, const Cache_Expr *exprs,
+                    const uint64_t *order, const uint64_t *cycle_items, String_View content)
+{
+    uint64_t cells_count = header->rows * header->cols;
+    for (uint64_t i = 0; i < cells_count; ++i) {
+        const Cache_Cell *cell = &cells[i];
+        if (cell->cloned > 1 || cell->clone_dir > DIR_DOWN) {
+            return false;
+        }
+
+        switch (cell->kind) {
+        case CELL_KIND_TEXT:
+            if (cell->as.text_offset > content.count || cell->text_count > content.count - cell->as.text_offset) {
+                return false;
+            }
+            break;
+        case CELL_KIND_NUMBER:
+            if (value_type(value_number(cell->as.number)) == VALUE_TEXT) {
+                return false;
+            }
+            break;
+        case CELL_KIND_EXPR:
+            if (cell->as.expr_index >= header->exprs_count || (cell->cloned && cell->source >= cells_count)) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < header->exprs_count; ++i) {
+        const Cache_Expr *expr = &exprs[i];
+        switch (expr->kind) {
+        case EXPR_KIND_NUMBER:
+        case EXPR_KIND_CELL:
+            break;
+        case EXPR_KIND_BOP:
+            if (expr->op >= COUNT_BOP_KINDS || expr->as.bop[0] >= header->exprs_count || expr->as.bop[1] >= header->exprs_count) {
+                return false;
+            }
+            break;
+        case EXPR_KIND_UOP:
+            if (expr->op > UOP_KIND_MINUS || expr->as.uop >= header->exprs_count) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if (!cache_exprs_acyclic(exprs, header->exprs_count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < header->order_count; ++i) {
+        if (order[i] >= cells_count) {
+            return false;
+        }
+    }
+
+    // Every cycle is its size followed by the offsets of its cells
+    for (uint64_t i = 0; i < header->cycles_count; ) {
+        uint64_t count = cycle_items[i++];
+        if (count == 0 || count > header->cycles_count - i) {
+            return false;
+        }
+        for (uint64_t end = i + count; i < end; ++i) {
+            if (cycle_items[i] >= cells_count) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Returns false if the cache is missing, corrupted or does not match the
+// content. The table is left untouched in that case.
+bool cache_load(const char *cache_path, Table *table, Expr_Buffer *eb, Cycle_Log *cycles, String_View content, uint64_t options)
+{
+    size_t size = 0;
+    uint8_t *data = file_map(cache_path, &size);
+    if (data == NULL) {
+        return false;
+    }
+
+    Cache_Header header;
+    size_t remaining = size;
+    if (!cache_take(&remaining, 1, sizeof(header))) {
+        file_unmap(data, size);
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (header.magic != CACHE_MAGIC ||
+            header.version != CACHE_VERSION ||
+            header.options != options ||
+            header.content_size != content.count ||
+            header.content_hash != fnv1a(content) ||
+            (header.rows > 0 && header.cols > SIZE_MAX / header.rows) ||
+            !cache_take(&remaining, header.rows * header.cols, sizeof(Cache_Cell)) ||
+            !cache_take(&remaining, header.exprs_count, sizeof(Cache_Expr)) ||
+            !cache_take(&remaining, header.order_count, sizeof(uint64_t)) ||
+            !cache_take(&remaining, header.cycles_count, sizeof(uint64_t)) ||
+            remaining != 0) {
+        file_unmap(data, size);
+        return false;
+    }
+
+    size_t cells_count = header.rows * header.cols;
+    const Cache_Cell *cells = (const Cache_Cell *) (data + sizeof(Cache_Header));
+    const Cache_Expr *exprs = (const Cache_Expr *) (cells + cells_count);
+    const uint64_t *order = (const uint64_t *) (exprs + header.exprs_count);
+    const uint64_t *cycle_items = order + header.order_count;
+    if (!cache_validate(&header, cells, exprs, order, cycle_items, content)) {
+        file_unmap(data, size);
+        return false;
+    }
+
+    table->rows = header.rows;
+    table->cols = header.cols;
+    table->cells = calloc(cells_count, sizeof(*table->cells));
+    for (size_t i = 0; i < cells_count; ++i) {
+        Cell *cell = &table->cells[i];
+        cell->kind = cells[i].kind;
+        cell->cloned = cells[i].cloned;
+        cell->clone_dir = cells[i].clone_dir;
+        cell->source = cells[i].source;
+        cell->file_col = cells[i].file_col;
+
+        switch (cell->kind) {
+        case CELL_KIND_TEXT: {
+            String_View text = {
+                .count = cells[i].text_count,
+                .data = content.data + cells[i].as.text_offset,
+            };
+            cell->value = table_push_text(table, text);
+        }
+        break;
+        case CELL_KIND_NUMBER:
+            cell->value = value_number(cells[i].as.number);
+            break;
+        case CELL_KIND_EXPR:
+            cell->expr = cells[i].as.expr_index;
+            break;
+        case CELL_KIND_CLONE:
+        default:
+            UNREACHABLE("validated by cache_validate()");
+        }
+    }
+
+    assert(eb->items == NULL);
+    eb->capacity = header.exprs_count;
+    eb->count = header.exprs_count;
+    eb->items = calloc(eb->capacity, sizeof(*eb->items));
+    if (eb->hashcons) {
+        expr_buffer_grow_memo(eb, 0);
+    }
+    for (size_t i = 0; i < header.exprs_count; ++i) {
+        Expr *expr = &eb->items[i];
+        expr->kind = exprs[i].kind;
+        expr->file_path = table->file_path;
+        expr->file_row = exprs[i].file_row;
+        expr->file_col = exprs[i].file_col;
+
+        switch (expr->kind) {
+        case EXPR_KIND_NUMBER:
+            expr->as.number = exprs[i].as.number;
+            break;
+        case EXPR_KIND_CELL:
+            expr->as.cell.row = exprs[i].as.cell[0];
+            expr->as.cell.col = exprs[i].as.cell[1];
+            break;
+        case EXPR_KIND_BOP:
+            expr->as.bop.kind = exprs[i].op;
+            expr->as.bop.lhs = exprs[i].as.bop[0];
+            expr->as.bop.rhs = exprs[i].as.bop[1];
+            break;
+        case EXPR_KIND_UOP:
+            expr->as.uop.kind = exprs[i].op;
+            expr->as.uop.param = exprs[i].as.uop;
+            break;
+        case EXPR_KIND_SHEET_CELL:
+        default:
+            UNREACHABLE("validated by cache_validate()");
+        }
+    }
+
+    table->order.count = 0;
+    for (size_t i = 0; i < header.order_count; ++i) {
+        Cell_Index cell_index = {
+            .row = order[i] / header.cols,
+            .col = order[i] % header.cols,
+        };
+        cell_indices_push(&table->order, cell_index);
+    }
+
+    for (size_t i = 0; i < header.cycles_count; ++i) {
+        cycle_log_push(cycles, cycle_items[i]);
+    }
+
+    file_unmap(data, size);
+    return true;
+}
+
+#ifndef _WIN32
+// Copy-on-write snapshots
+//
+// table_snapshot() freezes the state of a fully evaluated table into a
+// shared memory object. Every table_fork() of the snapshot maps it
+// privately: the pages of the cells, the dependents, the expressions and
+// the texts stay shared with the snapshot until the fork writes into
+// them, and then the kernel copies just the pages written to. A fork that
+// changes a few cells only pays for the pages of the cells recalculated
+// because of them.
+//
+// The mapping leaves room for the expressions and the texts the fork
+// adds. Past that they are copied to the heap. Even the scratch space of
+// table_recalc() is mapped, so it only takes the pages a fork touches. The items of the
+// dependents lists are not part of the mapping, the forks borrow them
+// from the snapshot, see table_own_dependents().
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    char **items;
+} Sources;
+
+void sources_push(Sources *sources, char *source)
+{
+    if (sources->count >= sources->capacity) {
+        sources->capacity = sources->capacity == 0 ? 16 : sources->capacity * 2;
+        sources->items = realloc(sources->items, sizeof(*sources->items) * sources->capacity);
+    }
+    sources->items[sources->count++] = source;
+}
+
+void sources_free(Sources *sources)
+{
+    for (size_t i = 0; i < sources->count; ++i) {
+        free(sources->items[i]);
+    }
+    free(sources->items);
+}
+
+typedef struct Snapshot Snapshot;
+
+struct Snapshot {
+    // The tables forked from the snapshot and the snapshots made from
+    // those
+    size_t refs;
+    int fd;
+
+    size_t rows;
+    size_t cols;
+    size_t exprs_count;
+    size_t exprs_capacity;
+    size_t texts_count;
+    size_t texts_capacity;
+    size_t cells_offset;
+    size_t dependents_offset;
+    size_t exprs_offset;
+    size_t texts_offset;
+    size_t dirty_offset;
+    size_t dirty_node_offset;
+
+    // The items of all the dependents lists
+    Cell_Index *dependents;
+
+    // The strings the expressions and the texts point into. Whoever makes
+    // the snapshot hands them over, see sheet_snapshot(). The older ones
+    // are in the parent.
+    Sources strings;
+    Snapshot *parent;
+};
+
+size_t page_align(size_t size)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+void snapshot_release(Snapshot *snapshot)
+{
+    while (snapshot != NULL) {
+        assert(snapshot->refs > 0);
+        snapshot->refs -= 1;
+        if (snapshot->refs > 0) {
+            return;
+        }
+
+        Snapshot *parent = snapshot->parent;
+        close(snapshot->fd);
+        free(snapshot->dependents);
+        sources_free(&snapshot->strings);
+        free(snapshot);
+        snapshot = parent;
+    }
+}
+
+// Returns NULL and sets errno on failure. The new snapshot has a single
+// reference owned by the caller.
+Snapshot *table_snapshot(Table *table, Expr_Buffer *eb)
+{
+    assert(table->dependents != NULL && "only tables with incremental recalculation can be forked");
+    assert(table->changed.count == 0);
+    assert(!eb->hashcons && "the memoized values are not shared");
+
+    size_t n = table->rows * table->cols;
+    Snapshot *snapshot = calloc(1, sizeof(*snapshot));
+    snapshot->refs = 1;
+    snapshot->rows = table->rows;
+    snapshot->cols = table->cols;
+    snapshot->exprs_count = eb->count;
+    snapshot->exprs_capacity = eb->count + eb->count / 2 + 1024;
+    snapshot->texts_count = table->texts.count;
+    snapshot->texts_capacity = table->texts.count + table->texts.count / 2 + 256;
+
+    size_t size = 0;
+    snapshot->cells_offset = size;
+    size += page_align(sizeof(Cell) * n);
+    snapshot->dependents_offset = size;
+    size += page_align(sizeof(Cell_Indices) * n);
+    snapshot->exprs_offset = size;
+    size += page_align(sizeof(Expr) * snapshot->exprs_capacity);
+    snapshot->texts_offset = size;
+    size += page_align(sizeof(String_View) * snapshot->texts_capacity);
+    // The scratch space of table_recalc() is all zeros, so it's never
+    // written to here and the forks only get the pages they touch
+    snapshot->dirty_offset = size;
+    size += page_align(sizeof(bool) * n);
+    snapshot->dirty_node_offset = size;
+    size += page_align(sizeof(size_t) * n);
+
+    // Anonymous, the object only lives as long as the descriptor
+    static size_t counter = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "/minicel-%ld-%zu", (long) getpid(), counter++);
+    snapshot->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (snapshot->fd < 0) {
+        free(snapshot);
+        return NULL;
+    }
+    shm_unlink(name);
+
+    uint8_t *data = MAP_FAILED;
+    if (ftruncate(snapshot->fd, size) < 0 ||
+            (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, snapshot->fd, 0)) == MAP_FAILED) {
+        int saved_errno = errno;
+        close(snapshot->fd);
+        free(snapshot);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    memcpy(data + snapshot->cells_offset, table->cells, sizeof(Cell) * n);
+    if (eb->count > 0) {
+        memcpy(data + snapshot->exprs_offset, eb->items, sizeof(Expr) * eb->count);
+    }
+    if (table->texts.count > 0) {
+        memcpy(data + snapshot->texts_offset, table->texts.items, sizeof(String_View) * table->texts.count);
+    }
+
+    size_t dependents_count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        dependents_count += table->dependents[i].count;
+    }
+    snapshot->dependents = malloc(sizeof(*snapshot->dependents) * dependents_count);
+    Cell_Indices *lists = (Cell_Indices *) (data + snapshot->dependents_offset);
+    size_t offset = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const Cell_Indices *deps = &table->dependents[i];
+        lists[i] = (Cell_Indices) {
+            .count = deps->count,
+            .capacity = 0,
+            .items = deps->count > 0 ? &snapshot->dependents[offset] : NULL,
+        };
+        if (deps->count > 0) {
+            memcpy(&snapshot->dependents[offset], deps->items, sizeof(*deps->items) * deps->count);
+            offset += deps->count;
+        }
+    }
+
+    munmap(data, size);
+    return snapshot;
+}
+
+// NULL for the empty sections
+void *snapshot_map(Snapshot *snapshot, size_t offset, size_t size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, snapshot->fd, offset);
+    return data == MAP_FAILED ? NULL : data;
+}
+
+// Makes the empty `table` and `eb` a copy-on-write copy of the snapshot,
+// which gets one more reference. The file path of the table is up to the
+// caller. Returns false and sets errno on failure.
+bool table_fork(Snapshot *snapshot, Table *table, Expr_Buffer *eb)
+{
+    size_t n = snapshot->rows * snapshot->cols;
+    Cell *cells = snapshot_map(snapshot, snapshot->cells_offset, sizeof(Cell) * n);
+    Cell_Indices *dependents = snapshot_map(snapshot, snapshot->dependents_offset, sizeof(Cell_Indices) * n);
+    Expr *exprs = snapshot_map(snapshot, snapshot->exprs_offset, sizeof(Expr) * snapshot->exprs_capacity);
+    String_View *texts = snapshot_map(snapshot, snapshot->texts_offset, sizeof(String_View) * snapshot->texts_capacity);
+    bool *dirty = snapshot_map(snapshot, snapshot->dirty_offset, sizeof(bool) * n);
+    size_t *dirty_node = snapshot_map(snapshot, snapshot->dirty_node_offset, sizeof(size_t) * n);
+    if ((n > 0 && (cells == NULL || dependents == NULL || dirty == NULL || dirty_node == NULL)) || exprs == NULL || texts == NULL) {
+        int saved_errno = errno;
+        if (cells) munmap(cells, sizeof(Cell) * n);
+        if (dependents) munmap(dependents, sizeof(Cell_Indices) * n);
+        if (dirty) munmap(dirty, sizeof(bool) * n);
+        if (dirty_node) munmap(dirty_node, sizeof(size_t) * n);
+        if (exprs) munmap(exprs, sizeof(Expr) * snapshot->exprs_capacity);
+        if (texts) munmap(texts, sizeof(String_View) * snapshot->texts_capacity);
+        errno = saved_errno;
+        return false;
+    }
+
+    table->cells = cells;
+    table->dependents = dependents;
+    table->rows = snapshot->rows;
+    table->cols = snapshot->cols;
+    table->mapped = true;
+    table->texts = (Texts) {
+        .count = snapshot->texts_count,
+        .capacity = snapshot->texts_capacity,
+        .items = texts,
+        .mapped = true,
+    };
+    table->dirty = dirty;
+    table->dirty_node = dirty_node;
+
+    eb->items = exprs;
+    eb->count = snapshot->exprs_count;
+    eb->capacity = snapshot->exprs_capacity;
+    eb->mapped = true;
+
+    snapshot->refs += 1;
+    return true;
+}
+
+// Daemon mode
+//
+// `minicel --serve <socket>` keeps named sheets in memory and answers a
+// line protocol over a Unix domain socket. Each request is a single line:
+//
+//   load <sheet> <input.csv>     load (or reload) the sheet from a file
+//   set <sheet> <cell> <value>   replace the cell, e.g. `set s A1 =B1*2`
+//   get <sheet> <cell>[:<cell>]  values of a cell or a rectangular range
+//   dump <sheet>                 the whole rendered table
+//   fork <sheet> <new-sheet>     a copy-on-write copy of the sheet
+//   unload <sheet>
+//   quit
+//
+// Each response starts with `OK <n>` followed by exactly n lines of
+// payload, or consists of a single `ERROR <message>` line.
+
+typedef struct {
+    char *name;
+    char *file_path;
+    char *content;
+    Table table;
+    Expr_Buffer eb;
+    // Text cells replaced by `set` keep views into these
+    Sources sources;
+    // The size of the expressions and the texts after the last
+    // compaction and of the ones `set` added since then, see
+    // sheet_compact()
+    size_t live_size;
+    size_t added_size;
+
+    // The snapshot the sheet is a fork of. Forking a sheet turns it into
+    // a fork of its own snapshot, see sheet_snapshot().
+    Snapshot *snapshot;
+    // Whether the sheet has changed since then
+    bool changed;
+} Sheet;
+
+void sheet_free(Sheet *sheet)
+{
+    free(sheet->name);
+    free(sheet->file_path);
+    free(sheet->content);
+    table_free(&sheet->table);
+    expr_buffer_free(&sheet->eb);
+    sources_free(&sheet->sources);
+    snapshot_release(sheet->snapshot);
+}
+
+// Makes sheet->snapshot hold the current state of the sheet. A new
+// snapshot takes over the strings the sheet owns, and the sheet itself
+// becomes a fork of it.
+bool sheet_snapshot(Sheet *sheet)
+{
+    if (sheet->snapshot != NULL && !sheet->changed) {
+        return true;
+    }
+
+    Snapshot *snapshot = table_snapshot(&sheet->table, &sheet->eb);
+    if (snapshot == NULL) {
+        return false;
+    }
+
+    Table table = {
+        .file_path = sheet->table.file_path,
+    };
+    Expr_Buffer eb = {0};
+    if (!table_fork(snapshot, &table, &eb)) {
+        int saved_errno = errno;
+        snapshot_release(snapshot);
+        errno = saved_errno;
+        return false;
+    }
+    // The fork holds the reference now
+    snapshot->refs -= 1;
+
+    if (sheet->content) sources_push(&snapshot->strings, sheet->content);
+    if (sheet->file_path) sources_push(&snapshot->strings, sheet->file_path);
+    for (size_t i = 0; i < sheet->sources.count; ++i) {
+        sources_push(&snapshot->strings, sheet->sources.items[i]);
+    }
+    sheet->content = NULL;
+    sheet->file_path = NULL;
+    sheet->sources.count = 0;
+    // Takes over the reference of the sheet to the previous snapshot
+    snapshot->parent = sheet->snapshot;
+
+    table_free(&sheet->table);
+    expr_buffer_free(&sheet->eb);
+    sheet->table = table;
+    sheet->eb = eb;
+    sheet->snapshot = snapshot;
+    sheet->changed = false;
+    return true;
+}
+
+// `set` only ever appends to the expression buffer and the strings of a
+// sheet. Once it added more than there was after the last compaction, the
+// expressions and the texts no cell refers to anymore are dropped, so the
+// memory of a long running daemon stays proportional to its sheets, not
+// to the amount of the edits.
+#define SHEET_COMPACT_SLACK (64 * 1024)
+
+// Drops the expressions and the text slots no cell refers to anymore.
+// With `strings` the live texts are copied into a new block returned
+// there, so nothing points into the old sources anymore. Otherwise they
+// keep pointing where they did. Returns the size of what is left.
+size_t table_compact(Table *table, Expr_Buffer *eb, char **strings)
+{
+    assert(!eb->hashcons && "the interned nodes can't move");
+    size_t n = table->rows * table->cols;
+
+    // The new index + 1 of every node reachable from a cell, 0 for the
+    // garbage. The nodes keep their order.
+    size_t *exprs_remap = calloc(eb->count, sizeof(*exprs_remap));
+    Expr_Indices stack = {0};
+    for (size_t i = 0; i < n; ++i) {
+        if (table->cells[i].kind == CELL_KIND_EXPR) {
+            expr_indices_push(&stack, table->cells[i].expr);
+        }
+    }
+    while (stack.count > 0) {
+        Expr_Index index = stack.items[--stack.count];
+        if (exprs_remap[index] != 0) {
+            continue;
+        }
+        exprs_remap[index] = 1;
+
+        const Expr *expr = expr_buffer_at(eb, index);
+        if (expr->kind == EXPR_KIND_BOP) {
+            expr_indices_push(&stack, expr->as.bop.lhs);
+            expr_indices_push(&stack, expr->as.bop.rhs);
+        } else if (expr->kind == EXPR_KIND_UOP) {
+            expr_indices_push(&stack, expr->as.uop.param);
+        }
+    }
+    free(stack.items);
+
+    size_t exprs_count = 0;
+    for (size_t i = 0; i < eb->count; ++i) {
+        if (exprs_remap[i] != 0) {
+            exprs_remap[i] = ++exprs_count;
+        }
+    }
+
+    size_t exprs_capacity = exprs_count + exprs_count / 2 + 128;
+    Expr *exprs = malloc(sizeof(*exprs) * exprs_capacity);
+    for (size_t i = 0; i < eb->count; ++i) {
+        if (exprs_remap[i] == 0) {
+            continue;
+        }
+
+        Expr expr = eb->items[i];
+        if (expr.kind == EXPR_KIND_BOP) {
+            expr.as.bop.lhs = exprs_remap[expr.as.bop.lhs] - 1;
+            expr.as.bop.rhs = exprs_remap[expr.as.bop.rhs] - 1;
+        } else if (expr.kind == EXPR_KIND_UOP) {
+            expr.as.uop.param = exprs_remap[expr.as.uop.param] - 1;
+        }
+        exprs[exprs_remap[i] - 1] = expr;
+    }
+
+    // The same for the text slots. Clones of a text share its slot.
+    Texts *texts = &table->texts;
+    size_t *texts_remap = calloc(texts->count, sizeof(*texts_remap));
+    size_t texts_count = 0;
+    size_t texts_size = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Cell *cell = &table->cells[i];
+        if (cell->kind == CELL_KIND_EXPR) {
+            cell->expr = exprs_remap[cell->expr] - 1;
+        }
+        if (value_type(cell->value) == VALUE_TEXT) {
+            uint32_t index = value_text_index(cell->value);
+            if (texts_remap[index] == 0) {
+                texts_remap[index] = ++texts_count;
+                texts_size += texts->items[index].count;
+            }
+            cell->value = value_text((uint32_t) texts_remap[index] - 1);
+        }
+    }
+
+    size_t texts_capacity = texts_count + 256;
+    String_View *items = malloc(sizeof(*items) * texts_capacity);
+    if (strings) {
+        *strings = malloc(texts_size + 1);
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < texts->count; ++i) {
+        if (texts_remap[i] == 0) {
+            continue;
+        }
+
+        String_View text = texts->items[i];
+        if (strings) {
+            memcpy(*strings + size, text.data, text.count);
+            text.data = *strings + size;
+        }
+        items[texts_remap[i] - 1] = text;
+        size += text.count;
+    }
+
+    // The old expressions and texts may be mapped from the snapshot the
+    // sheet is a fork of, the snapshot keeps its own copy
+    if (eb->mapped) {
+        file_unmap(eb->items, sizeof(*eb->items) * eb->capacity);
+    } else {
+        free(eb->items);
+    }
+    eb->items = exprs;
+    eb->count = exprs_count;
+    eb->capacity = exprs_capacity;
+    eb->mapped = false;
+
+    if (texts->mapped) {
+        file_unmap(texts->items, sizeof(*texts->items) * texts->capacity);
+    } else {
+        free(texts->items);
+    }
+    *texts = (Texts) {
+        .count = texts_count,
+        .capacity = texts_capacity,
+        .items = items,
+    };
+
+    free(exprs_remap);
+    free(texts_remap);
+    return exprs_count * sizeof(Expr) + texts_size;
+}
+
+void sheet_compact(Sheet *sheet)
+{
+    char *strings = NULL;
+    sheet->live_size = table_compact(&sheet->table, &sheet->eb, &strings);
+    sheet->added_size = 0;
+
+    // Nothing points into the file or the old sources anymore
+    free(sheet->content);
+    sheet->content = NULL;
+    sources_free(&sheet->sources);
+    sheet->sources = (Sources) {0};
+    sources_push(&sheet->sources, strings);
+}
+
+// Accounts for what `set` added to the sheet, compacting it when that
+// outgrows the rest
+void sheet_grow(Sheet *sheet, size_t size)
+{
+    sheet->added_size += size;
+    if (sheet->added_size > sheet->live_size + SHEET_COMPACT_SLACK) {
+        sheet_compact(sheet);
+    }
+}
+
+typedef struct {
+    int fd;
+    FILE *out;
+    size_t size;
+    char buffer[64 * 1024];
+} Client;
+
+typedef struct {
+    Sheet *sheets;
+    size_t sheets_count;
+    size_t sheets_capacity;
+    Tmp_Cstr tc;
+} Server;
+
+char *sv_to_cstr(String_View sv)
+{
+    char *result = malloc(sv.count + 1);
+    memcpy(result, sv.data, sv.count);
+    result[sv.count] = '\0';
+    return result;
+}
+
+Sheet *server_find_sheet(Server *server, String_View name)
+{
+    for (size_t i = 0; i < server->sheets_count; ++i) {
+        if (sv_eq(sv_from_cstr(server->sheets[i].name), name)) {
+            return &server->sheets[i];
+        }
+    }
+    return NULL;
+}
+
+void server_unload_sheet(Server *server, Sheet *sheet)
+{
+    sheet_free(sheet);
+    *sheet = server->sheets[--server->sheets_count];
+}
+
+// Adds the sheet or replaces the one with the same name
+void server_put_sheet(Server *server, Sheet sheet)
+{
+    Sheet *existing = server_find_sheet(server, sv_from_cstr(sheet.name));
+    if (existing != NULL) {
+        sheet_free(existing);
+        *existing = sheet;
+        return;
+    }
+
+    if (server->sheets_count >= server->sheets_capacity) {
+        server->sheets_capacity = server->sheets_capacity == 0 ? 16 : server->sheets_capacity * 2;
+        server->sheets = realloc(server->sheets, sizeof(*server->sheets) * server->sheets_capacity);
+    }
+    server->sheets[server->sheets_count++] = sheet;
+}
+
+bool serve_parse_range(Server *server, Table *table, String_View range, Cell_Index *begin, Cell_Index *end)
+{
+    String_View first = sv_chop_by_delim(&range, ':');
+    if (!parse_cell_index(first, &server->tc, begin)) {
+        return false;
+    }
+
+    if (range.count == 0) {
+        *end = *begin;
+    } else if (!parse_cell_index(range, &server->tc, end)) {
+        return false;
+    }
+
+    return begin->row <= end->row && begin->col <= end->col && table_contains(table, *end);
+}
+
+void serve_request(Server *server, String_View request, FILE *out)
+{
+    String_View command = sv_chop_by_delim(&request, ' ');
+    request = sv_trim(request);
+    String_View name = sv_chop_by_delim(&request, ' ');
+    request = sv_trim(request);
+
+    if (sv_eq(command, SV("load"))) {
+        if (name.count == 0 || request.count == 0) {
+            fprintf(out, "ERROR usage: load <sheet> <input.csv>\n");
+            return;
+        }
+
+        Sheet sheet = {0};
+        sheet.name = sv_to_cstr(name);
+        sheet.file_path = sv_to_cstr(request);
+        sheet.content = table_load_from_file(&sheet.table, &sheet.eb, &server->tc, sheet.file_path, NULL);
+        if (sheet.content == NULL) {
+            fprintf(out, "ERROR could not load %s\n", sheet.file_path);
+            sheet_free(&sheet);
+            return;
+        }
+        table_build_dependents(&sheet.table, &sheet.eb);
+
+        server_put_sheet(server, sheet);
+        fprintf(out, "OK 0\n");
+        return;
+    }
+
+    if (sv_eq(command, SV("quit"))) {
+        return;
+    }
+
+    if (!sv_eq(command, SV("set")) && !sv_eq(command, SV("get")) && !sv_eq(command, SV("dump")) &&
+            !sv_eq(command, SV("fork")) && !sv_eq(command, SV("unload"))) {
+        fprintf(out, "ERROR unknown command `"SV_Fmt"`\n", SV_Arg(command));
+        return;
+    }
+
+    Sheet *sheet = server_find_sheet(server, name);
+    if (sheet == NULL) {
+        fprintf(out, "ERROR unknown sheet `"SV_Fmt"`\n", SV_Arg(name));
+        return;
+    }
+    Table *table = &sheet->table;
+
+    if (sv_eq(command, SV("set"))) {
+        String_View cell_ref = sv_chop_by_delim(&request, ' ');
+        Cell_Index cell_index = {0};
+        if (!parse_cell_index(cell_ref, &server->tc, &cell_index) || !table_contains(table, cell_index)) {
+            fprintf(out, "ERROR invalid cell `"SV_Fmt"`\n", SV_Arg(cell_ref));
+            return;
+        }
+
+        // Unlike in a file, a cell that does not parse is rejected
+        char *source = sv_to_cstr(request);
+        Cell old = *table_cell_at(table, cell_index);
+        size_t exprs_count = sheet->eb.count;
+        if (!table_set_cell(table, &sheet->eb, &server->tc, cell_index, sv_from_cstr(source))) {
+            free(source);
+            table_replace_cell(table, &sheet->eb, cell_index, old);
+            table_recalc(table, &sheet->eb);
+            sheet_grow(sheet, (sheet->eb.count - exprs_count) * sizeof(Expr));
+            fprintf(out, "ERROR could not parse `"SV_Fmt"`\n", SV_Arg(request));
+            return;
+        }
+
+        // Only the text cells keep views into the source
+        size_t added_size = (sheet->eb.count - exprs_count) * sizeof(Expr);
+        Cell *cell = table_cell_at(table, cell_index);
+        if (cell->kind == CELL_KIND_TEXT && value_type(cell->value) == VALUE_TEXT) {
+            added_size += strlen(source);
+            sources_push(&sheet->sources, source);
+        } else {
+            free(source);
+        }
+        sheet->changed = true;
+
+        table_recalc(table, &sheet->eb);
+        sheet_grow(sheet, added_size);
+        fprintf(out, "OK 0\n");
+    } else if (sv_eq(command, SV("get"))) {
+        Cell_Index begin = {0};
+        Cell_Index end = {0};
+        if (!serve_parse_range(server, table, request, &begin, &end)) {
+            fprintf(out, "ERROR invalid range `"SV_Fmt"`\n", SV_Arg(request));
+            return;
+        }
+
+        fprintf(out, "OK %zu\n", end.row - begin.row + 1);
+        for (size_t row = begin.row; row <= end.row; ++row) {
+            for (size_t col = begin.col; col <= end.col; ++col) {
+                Cell_Index cell_index = {
+                    .row = row,
+                    .col = col,
+                };
+                fprint_cell(out, table, table_cell_at(table, cell_index));
+                if (col < end.col) {
+                    fprintf(out, "|");
+                }
+            }
+            fprintf(out, "\n");
+        }
+    } else if (sv_eq(command, SV("dump"))) {
+        fprintf(out, "OK %zu\n", table->rows);
+        table_render(table, out);
+    } else if (sv_eq(command, SV("fork"))) {
+        if (request.count == 0) {
+            fprintf(out, "ERROR usage: fork <sheet> <new-sheet>\n");
+            return;
+        }
+        if (!sheet_snapshot(sheet)) {
+            fprintf(out, "ERROR could not snapshot `"SV_Fmt"`: %s\n", SV_Arg(name), strerror(errno));
+            return;
+        }
+
+        Sheet fork = {
+            .name = sv_to_cstr(request),
+            .table = {
+                .file_path = table->file_path,
+            },
+            .snapshot = sheet->snapshot,
+        };
+        if (!table_fork(sheet->snapshot, &fork.table, &fork.eb)) {
+            fprintf(out, "ERROR could not fork `"SV_Fmt"`: %s\n", SV_Arg(name), strerror(errno));
+            free(fork.name);
+            return;
+        }
+        server_put_sheet(server, fork);
+        fprintf(out, "OK 0\n");
+    } else if (sv_eq(command, SV("unload"))) {
+        server_unload_sheet(server, sheet);
+        fprintf(out, "OK 0\n");
+    } else {
+        UNREACHABLE("unknown command");
+    }
+}
+
+// Returns false when the client should be disconnected
+bool serve_client(Server *server, Client *client)
+{
+    ssize_t n = read(client->fd, client->buffer + client->size, sizeof(client->buffer) - client->size);
+    if (n <= 0) {
+        return false;
+    }
+    client->size += (size_t) n;
+
+    String_View input = {
+        .count = client->size,
+        .data = client->buffer,
+    };
+
+    bool quit = false;
+    String_View request = {0};
+    while (!quit && sv_try_chop_by_delim(&input, '\n', &request)) {
+        request = sv_trim(request);
+        if (request.count > 0) {
+            serve_request(server, request, client->out);
+            quit = sv_eq(request, SV("quit"));
+        }
+    }
+    fflush(client->out);
+
+    if (input.count == sizeof(client->buffer)) {
+        fprintf(client->out, "ERROR request is too long\n");
+        fflush(client->out);
+        return false;
+    }
+
+    memmove(client->buffer, input.data, input.count);
+    client->size = input.count;
+    return !quit;
+}
+
+// Set by SIGINT and SIGTERM, the daemon cleans up and exits
+static volatile sig_atomic_t serve_stopped = 0;
+
+void serve_stop(int signum)
+{
+    (void) signum;
+    serve_stopped = 1;
+}
+
+int serve(const char *socket_path)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path %s is too long\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    workbook.resident = "--serve";
+    // A client hanging up in the middle of a response must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, serve_stop);
+    signal(SIGTERM, serve_stop);
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        fprintf(stderr, "ERROR: could not create socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    unlink(socket_path);
+    if (bind(server_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(server_fd, 64) < 0) {
+        fprintf(stderr, "ERROR: could not listen on %s: %s\n", socket_path, strerror(errno));
+        close(server_fd);
+        return 1;
+    }
+    fprintf(stderr, "INFO: listening on %s\n", socket_path);
+
+    Server server = {0};
+    Client **clients = NULL;
+    size_t clients_count = 0;
+    struct pollfd *fds = NULL;
+
+    int exit_code = 1;
+    for (;;) {
+        if (serve_stopped) {
+            fprintf(stderr, "INFO: stopping\n");
+            exit_code = 0;
+            break;
+        }
+
+        fds = realloc(fds, sizeof(*fds) * (clients_count + 1));
+        fds[0] = (struct pollfd) {
+            .fd = server_fd,
+            .events = POLLIN,
+        };
+        for (size_t i = 0; i < clients_count; ++i) {
+            fds[i + 1] = (struct pollfd) {
+                .fd = clients[i]->fd,
+                .events = POLLIN,
+            };
+        }
+
+        if (poll(fds, clients_count + 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        // Walk backwards so disconnected clients can be swapped out
+        for (size_t i = clients_count; i > 0; --i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            Client *client = clients[i - 1];
+            if (!serve_client(&server, client)) {
+                fclose(client->out);
+                close(client->fd);
+                free(client);
+                clients[i - 1] = clients[--clients_count];
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(server_fd, NULL, NULL);
+            if (fd < 0) {
+                fprintf(stderr, "WARNING: could not accept connection: %s\n", strerror(errno));
+                continue;
+            }
+
+            Client *client = calloc(1, sizeof(*client));
+            client->fd = fd;
+            client->out = fdopen(dup(fd), "w");
+            clients = realloc(clients, sizeof(*clients) * (clients_count + 1));
+            clients[clients_count++] = client;
+        }
+    }
+
+    for (size_t i = 0; i < clients_count; ++i) {
+        fclose(clients[i]->out);
+        close(clients[i]->fd);
+        free(clients[i]);
+    }
+    free(clients);
+    free(fds);
+    for (size_t i = 0; i < server.sheets_count; ++i) {
+        sheet_free(&server.sheets[i]);
+    }
+    free(server.sheets);
+    free(server.tc.cstr);
+    close(server_fd);
+    unlink(socket_path);
+
+    return exit_code;
+}
+#else
+int serve(const char *socket_path)
+{
+    (void) socket_path;
+    fprintf(stderr, "ERROR: --serve is not supported on this platform\n");
+    return 1;
+}
+#endif // _WIN32
+
+#ifdef __linux__
+// Watch mode
+//
+// `minicel --watch <input.csv>` keeps the parsed table resident and
+// re-emits it every time the file is saved. The new content is compared
+// with the previous one row by row using hashes of the lines. Only the
+// rows that differ are parsed again, and only the cells affected by them
+// are recalculated. Any change in the size of the table, or any `:^*`
+// fill, falls back to loading it from scratch.
+
+typedef struct {
+    const char *file_path;
+    char *content;
+    size_t content_size;
+    Table table;
+    Expr_Buffer eb;
+    Tmp_Cstr tc;
+    const char **line_starts;
+    uint64_t *line_hashes;
+    // Like the ones of a Sheet, the updates only ever append to the
+    // expressions and the text slots, see watch_grow()
+    size_t live_size;
+    size_t added_size;
+} Watch;
+
+void index_lines(String_View content, size_t rows, const char **starts, uint64_t *hashes)
+{
+    for (size_t row = 0; row < rows; ++row) {
+        String_View line = sv_chop_by_delim(&content, '\n');
+        starts[row] = line.data;
+        hashes[row] = fnv1a(line);
+    }
+}
+
+void watch_unload(Watch *watch)
+{
+    free(watch->content);
+    table_free(&watch->table);
+    expr_buffer_free(&watch->eb);
+    free(watch->line_starts);
+    free(watch->line_hashes);
+    watch->content = NULL;
+    memset(&watch->table, 0, sizeof(watch->table));
+    memset(&watch->eb, 0, sizeof(watch->eb));
+    watch->line_starts = NULL;
+    watch->line_hashes = NULL;
+    watch->live_size = 0;
+    watch->added_size = 0;
+}
+
+// Accounts for what an update added, compacting the table when that
+// outgrows the rest like sheet_grow() does. The texts keep pointing into
+// the content of the file.
+void watch_grow(Watch *watch, size_t size)
+{
+    watch->added_size += size;
+    if (watch->added_size > watch->live_size + SHEET_COMPACT_SLACK) {
+        watch->live_size = table_compact(&watch->table, &watch->eb, NULL);
+        watch->added_size = 0;
+    }
+}
+
+bool watch_load(Watch *watch)
+{
+    watch_unload(watch);
+
+    watch->content = table_load_from_file(&watch->table, &watch->eb, &watch->tc, watch->file_path, &watch->content_size);
+    if (watch->content == NULL) {
+        return false;
+    }
+    table_build_dependents(&watch->table, &watch->eb);
+
+    String_View input = {
+        .count = watch->content_size,
+        .data = watch->content,
+    };
+    size_t rows = watch->table.rows;
+    watch->line_starts = malloc(sizeof(*watch->line_starts) * rows);
+    watch->line_hashes = malloc(sizeof(*watch->line_hashes) * rows);
+    index_lines(input, rows, watch->line_starts, watch->line_hashes);
+    return true;
+}
+
+bool watch_update(Watch *watch)
+{
+    size_t content_size = 0;
+    char *content = slurp_file(watch->file_path, &content_size);
+    if (content == NULL) {
+        fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                watch->file_path, strerror(errno));
+        return false;
+    }
+
+    String_View input = {
+        .count = content_size,
+        .data = content,
+    };
+
+    size_t rows = 0;
+    size_t cols = 0;
+    estimate_table_size(input, &rows, &cols);
+    if (watch->content == NULL || rows != watch->table.rows || cols != watch->table.cols) {
+        free(content);
+        return watch_load(watch);
+    }
+
+    const char **line_starts = malloc(sizeof(*line_starts) * rows);
+    uint64_t *line_hashes = malloc(sizeof(*line_hashes) * rows);
+    index_lines(input, rows, line_starts, line_hashes);
+
+    // A `:^*` fill changes the meaning of the rows below it, which don't
+    // have to change themselves. Sheets with fills, before or after the
+    // change, are loaded from scratch. So are the changes of the header
+    // row, which may rename the columns the formulas refer to.
+    bool filled = watch->table.filled || (rows > 0 && line_hashes[0] != watch->line_hashes[0]);
+    for (size_t row = 0; !filled && row < rows; ++row) {
+        if (line_hashes[row] != watch->line_hashes[row]) {
+            String_View line = {
+                .count = content_size - (line_starts[row] - content),
+                .data = line_starts[row],
+            };
+            line = sv_chop_by_delim(&line, '\n');
+            for (size_t i = 0; !filled && i + 3 <= line.count; ++i) {
+                filled = memcmp(&line.data[i], ":^*", 3) == 0;
+            }
+        }
+    }
+    if (filled) {
+        free(line_starts);
+        free(line_hashes);
+        free(content);
+        return watch_load(watch);
+    }
+
+    Table *table = &watch->table;
+
+    // The texts of the unchanged rows point into the old content. Move
+    // them over to the new one. Clones of text share the slot of the cell
+    // they clone, that one moves it.
+    for (size_t row = 0; row < rows; ++row) {
+        if (line_hashes[row] != watch->line_hashes[row]) {
+            continue;
+        }
+
+        for (size_t col = 0; col < cols; ++col) {
+            Cell_Index cell_index = {
+                .row = row,
+                .col = col,
+            };
+            Cell *cell = table_cell_at(table, cell_index);
+            if (!cell->cloned && value_type(cell->value) == VALUE_TEXT) {
+                String_View *text = &table->texts.items[value_text_index(cell->value)];
+                text->data = line_starts[row] + (text->data - watch->line_starts[row]);
+            }
+        }
+    }
+
+    // Parse the changed rows again. The cells that don't parse become
+    // #PARSE! like they would on the first load.
+    size_t exprs_count = watch->eb.count;
+    size_t texts_count = table->texts.count;
+    for (size_t row = 0; row < rows; ++row) {
+        if (line_hashes[row] == watch->line_hashes[row]) {
+            continue;
+        }
+
+        String_View line = {
+            .count = content_size - (line_starts[row] - content),
+            .data = line_starts[row],
+        };
+        line = sv_chop_by_delim(&line, '\n');
+        const char *const line_start = line.data;
+        for (size_t col = 0; col < cols; ++col) {
+            String_View cell_value = sv_trim(sv_chop_by_delim(&line, '|'));
+            Cell_Index cell_index = {
+                .row = row,
+                .col = col,
+            };
+            table_set_cell(table, &watch->eb, &watch->tc, cell_index, cell_value);
+            table_cell_at(table, cell_index)->file_col = cell_value.data - line_start + 1;
+        }
+    }
+
+    free(watch->content);
+    free(watch->line_starts);
+    free(watch->line_hashes);
+    watch->content = content;
+    watch->content_size = content_size;
+    watch->line_starts = line_starts;
+    watch->line_hashes = line_hashes;
+
+    table_recalc(table, &watch->eb);
+    watch_grow(watch, (watch->eb.count - exprs_count) * sizeof(Expr) +
+               (table->texts.count - texts_count) * sizeof(String_View));
+    return true;
+}
+
+int watch(const char *file_path)
+{
+    workbook.resident = "--watch";
+
+    // Editors often save by renaming a temporary file over the original
+    // one, so watch the directory rather than the file itself
+    const char *slash = strrchr(file_path, '/');
+    const char *file_name = slash ? slash + 1 : file_path;
+    char *dir_path = slash ? sv_to_cstr((String_View) {
+        .count = (size_t) (slash - file_path) + 1,
+        .data = file_path,
+    }) : sv_to_cstr(SV("."));
+
+    int fd = inotify_init();
+    if (fd < 0 || inotify_add_watch(fd, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "ERROR: could not watch %s: %s\n", dir_path, strerror(errno));
+        free(dir_path);
+        return 1;
+    }
+    free(dir_path);
+
+    Watch watch = {
+        .file_path = file_path,
+    };
+
+    bool changed = true;
+    for (;;) {
+        if (changed && watch_update(&watch)) {
+            table_render(&watch.table, stdout);
+            printf("\n");
+            fflush(stdout);
+        }
+
+        char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: could not read inotify events: %s\n", strerror(errno));
+            break;
+        }
+
+        changed = false;
+        for (char *ptr = events; ptr < events + n;) {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            if (event->len > 0 && strcmp(event->name, file_name) == 0) {
+                changed = true;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    watch_unload(&watch);
+    free(watch.tc.cstr);
+    close(fd);
+    return 1;
+}
+#else
+int watch(const char *file_path)
+{
+    (void) file_path;
+    fprintf(stderr, "ERROR: --watch is not supported on this platform\n");
+    return 1;
+}
+#endif // __linux__
+
+typedef struct {
+    size_t offset;
+    double exclusive_secs;
+} Profile_Entry;
+
+int compare_profile_entries(const void *a, const void *b)
+{
+    double x = ((const Profile_Entry *) a)->exclusive_secs;
+    double y = ((const Profile_Entry *) b)->exclusive_secs;
+    return (x < y) - (x > y);
+}
+
+// Prints the `top` cells with the highest exclusive evaluation time
+void profiler_report(FILE *stream, Table *table, Expr_Buffer *eb, size_t top)
+{
+    Profiler *p = table->profiler;
+    size_t n = table->rows * table->cols;
+
+    table_build_dependents(table, eb);
+    for (size_t row = 0; row < table->rows; ++row) {
+        for (size_t col = 0; col < table->cols; ++col) {
+            Cell_Index cell_index = {
+                .row = row,
+                .col = col,
+            };
+            size_t offset = table_cell_offset(table, cell_index);
+            table_collect_precedents(table, eb, cell_index);
+            p->cells[offset].fan_in = table->precedents.count;
+            p->cells[offset].fan_out = table->dependents[offset].count;
+        }
+    }
+
+    Profile_Entry *entries = malloc(sizeof(*entries) * n);
+    for (size_t i = 0; i < n; ++i) {
+        entries[i].offset = i;
+        entries[i].exclusive_secs = p->cells[i].exclusive_secs;
+    }
+    qsort(entries, n, sizeof(*entries), compare_profile_entries);
+
+    if (top > n) {
+        top = n;
+    }
+
+    fprintf(stream, "%-24s %10s %10s %10s %10s %6s %6s %7s\n",
+            "cell", "excl ms", "incl ms", "excl nodes", "incl nodes",
+            "depth", "fan-in", "fan-out");
+    for (size_t i = 0; i < top; ++i) {
+        const Cell *cell = &table->cells[entries[i].offset];
+        const Cell_Profile *cp = &p->cells[entries[i].offset];
+
+        char location[256];
+        snprintf(location, sizeof(location), "%s:%zu:%zu", table->file_path, entries[i].offset / table->cols + 1, cell->file_col);
+        fprintf(stream, "%-24s %10.3f %10.3f %10zu %10zu %6zu %6zu %7zu\n",
+                location, cp->exclusive_secs * 1e3, cp->inclusive_secs * 1e3,
+                cp->exclusive_nodes, cp->inclusive_nodes,
+                cp->depth, cp->fan_in, cp->fan_out);
+    }
+
+    free(entries);
+}
+
+// Prints how many cells ended up with each kind of error, counting only
+// the `cells` unless it's NULL. Returns the total amount of them.
+size_t table_report_errors(Table *table, const Cell_Indices *cells, FILE *stream)
+{
+    size_t counts[COUNT_ERRORS] = {0};
+    size_t total = 0;
+    size_t count = cells ? cells->count : table->rows * table->cols;
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = cells ? table_cell_offset(table, cells->items[i]) : i;
+        Error_Kind error = value_error_kind(table->cells[offset].value);
+        if (error != ERROR_NONE) {
+            counts[error] += 1;
+            total += 1;
+        }
+    }
+
+    if (total > 0) {
+        fprintf(stream, "%s: ERROR: %zu cell%s with errors:", table->file_path, total, total == 1 ? "" : "s");
+        for (Error_Kind error = ERROR_NONE + 1; error < COUNT_ERRORS; ++error) {
+            if (counts[error] > 0) {
+                fprintf(stream, " %zu %s", counts[error], error_kind_as_cstr(error));
+            }
+        }
+        fprintf(stream, "\n");
+    }
+
+    return total;
+}
+
+void table_count_cell_kinds(Table *table, size_t first_row, size_t *cell_kinds)
+{
+    for (size_t i = first_row * table->cols; i < table->rows * table->cols; ++i) {
+        cell_kinds[table->cells[i].kind] += 1;
+    }
+}
+
+// In KiB, 0 when the platform does not tell
+size_t peak_rss_kib(void)
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t) usage.ru_maxrss / 1024;
+#else
+    return (size_t) usage.ru_maxrss;
+#endif // __APPLE__
+#else
+    return 0;
+#endif // _WIN32
+}
+
+// `cell_kinds` are counted right after parsing, while the clones are
+// still clones. The column types are the ones that held up to the end of
+// the parsing.
+void stats_report(FILE *stream, bool json, const size_t *cell_kinds, const Table *table, Expr_Buffer *eb)
+{
+    size_t expr_kinds[EXPR_KIND_SHEET_CELL + 1] = {0};
+    for (size_t i = 0; i < eb->count; ++i) {
+        expr_kinds[eb->items[i].kind] += 1;
+    }
+
+    size_t column_types[COUNT_COLUMN_TYPES] = {0};
+    if (table->column_types) {
+        for (size_t col = 0; col < table->cols; ++col) {
+            // The columns without a single value are MIXED
+            Column_Type type = table->column_types[col];
+            column_types[type == COUNT_COLUMN_TYPES ? COLUMN_TYPE_MIXED : type] += 1;
+        }
+    }
+
+    if (json) {
+        fprintf(stream, "{\"phases\":{");
+        for (Phase phase = 0; phase < COUNT_PHASES; ++phase) {
+            fprintf(stream, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+                    phase > 0 ? "," : "", phase_names[phase],
+                    stats.wall[phase] * 1e3, stats.cpu[phase] * 1e3);
+        }
+        fprintf(stream, "},\"cells\":{");
+        for (Cell_Kind kind = 0; kind <= CELL_KIND_CLONE; ++kind) {
+            fprintf(stream, "%s\"%s\":%zu", kind > 0 ? "," : "", cell_kind_as_cstr(kind), cell_kinds[kind]);
+        }
+        fprintf(stream, "},\"columns\":{");
+        for (Column_Type type = 0; type < COUNT_COLUMN_TYPES; ++type) {
+            fprintf(stream, "%s\"%s\":%zu", type > 0 ? "," : "", column_type_as_cstr(type), column_types[type]);
+        }
+        fprintf(stream, "},\"exprs\":{");
+        for (Expr_Kind kind = 0; kind <= EXPR_KIND_SHEET_CELL; ++kind) {
+            fprintf(stream, "%s\"%s\":%zu", kind > 0 ? "," : "", expr_kind_as_cstr(kind), expr_kinds[kind]);
+        }
+        fprintf(stream, "},\"expr_buffer\":{\"count\":%zu,\"capacity\":%zu,\"reallocs\":%zu}",
+                eb->count, eb->capacity, eb->reallocs);
+        fprintf(stream, ",\"max_eval_depth\":%zu,\"peak_rss_kib\":%zu}\n",
+                stats.max_eval_depth, peak_rss_kib());
+        return;
+    }
+
+    double total_wall = 0.0;
+    double total_cpu = 0.0;
+    fprintf(stream, "%-10s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    for (Phase phase = 0; phase < COUNT_PHASES; ++phase) {
+        fprintf(stream, "%-10s %12.3f %12.3f\n", phase_names[phase], stats.wall[phase] * 1e3, stats.cpu[phase] * 1e3);
+        total_wall += stats.wall[phase];
+        total_cpu += stats.cpu[phase];
+    }
+    fprintf(stream, "%-10s %12.3f %12.3f\n", "total", total_wall * 1e3, total_cpu * 1e3);
+
+    fprintf(stream, "cells:");
+    for (Cell_Kind kind = 0; kind <= CELL_KIND_CLONE; ++kind) {
+        fprintf(stream, " %s %zu", cell_kind_as_cstr(kind), cell_kinds[kind]);
+    }
+    fprintf(stream, "\ncolumns:");
+    for (Column_Type type = 0; type < COUNT_COLUMN_TYPES; ++type) {
+        fprintf(stream, " %s %zu", column_type_as_cstr(type), column_types[type]);
+    }
+    fprintf(stream, "\nexprs:");
+    for (Expr_Kind kind = 0; kind <= EXPR_KIND_SHEET_CELL; ++kind) {
+        fprintf(stream, " %s %zu", expr_kind_as_cstr(kind), expr_kinds[kind]);
+    }
+    fprintf(stream, "\nexpr buffer: count %zu, capacity %zu, reallocs %zu\n", eb->count, eb->capacity, eb->reallocs);
+    fprintf(stream, "max eval depth: %zu\n", stats.max_eval_depth);
+    fprintf(stream, "peak rss: %zu KiB\n", peak_rss_kib());
+}
+
+// Output projection
+//
+// `--rows`, `--columns` and `--cells` restrict the output to a part of
+// the table. Only the requested cells and the cells they transitively
+// depend on get evaluated, see table_eval_cells().
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t *items;
+} Axis;
+
+void axis_push(Axis *axis, size_t index)
+{
+    if (axis->count >= axis->capacity) {
+        axis->capacity = axis->capacity == 0 ? 16 : axis->capacity * 2;
+        axis->items = realloc(axis->items, sizeof(*axis->items) * axis->capacity);
+    }
+
+    axis->items[axis->count++] = index;
+}
+
+typedef struct {
+    // The rows and the columns of the part of the table to render. Empty
+    // means all of them.
+    Axis rows;
+    Axis cols;
+    // Rendered as a list of `<cell>|<value>` instead of a table
+    Cell_Indices cells;
+} Projection;
+
+bool projection_enabled(const Projection *projection)
+{
+    return projection->rows.count > 0 || projection->cols.count > 0 || projection->cells.count > 0;
+}
+
+void projection_free(Projection *projection)
+{
+    free(projection->rows.items);
+    free(projection->cols.items);
+    free(projection->cells.items);
+}
+
+bool parse_axis_index(String_View text, bool letter, Tmp_Cstr *tc, size_t *out)
+{
+    if (letter) {
+        if (text.count != 1 || !isupper(*text.data)) {
+            return false;
+        }
+        *out = *text.data - 'A';
+        return true;
+    }
+
+    long int index = 0;
+    if (!sv_strtol(text, tc, &index) || index < 0) {
+        return false;
+    }
+    *out = (size_t) index;
+    return true;
+}
+
+// Comma separated rows like `1,5:10`, or columns like `A,C:E` if
+// `letters`. The ranges are inclusive.
+bool parse_axis(String_View list, bool letters, Tmp_Cstr *tc, Axis *axis)
+{
+    while (list.count > 0) {
+        String_View range = sv_chop_by_delim(&list, ',');
+        String_View first = sv_chop_by_delim(&range, ':');
+        size_t begin = 0;
+        size_t end = 0;
+        if (!parse_axis_index(first, letters, tc, &begin)) {
+            return false;
+        }
+        if (range.count == 0) {
+            end = begin;
+        } else if (!parse_axis_index(range, letters, tc, &end) || end < begin) {
+            return false;
+        }
+
+        for (size_t index = begin; index <= end; ++index) {
+            axis_push(axis, index);
+        }
+    }
+    return axis->count > 0;
+}
+
+// Comma separated cells like `A1,B2:C3`. A range adds all the cells of
+// the rectangle row by row.
+bool parse_cell_list(String_View list, Tmp_Cstr *tc, Cell_Indices *cells)
+{
+    while (list.count > 0) {
+        String_View range = sv_chop_by_delim(&list, ',');
+        String_View first = sv_chop_by_delim(&range, ':');
+        Cell_Index begin = {0};
+        Cell_Index end = {0};
+        if (!parse_cell_index(first, tc, &begin)) {
+            return false;
+        }
+        if (range.count == 0) {
+            end = begin;
+        } else if (!parse_cell_index(range, tc, &end) || end.row < begin.row || end.col < begin.col) {
+            return false;
+        }
+
+        for (size_t row = begin.row; row <= end.row; ++row) {
+            for (size_t col = begin.col; col <= end.col; ++col) {
+                Cell_Index cell_index = {
+                    .row = row,
+                    .col = col,
+                };
+                cell_indices_push(cells, cell_index);
+            }
+        }
+    }
+    return cells->count > 0;
+}
+
+// Reports everything the projection references outside of the table
+bool projection_check(const Projection *projection, const Table *table)
+{
+    bool ok = true;
+    for (size_t i = 0; i < projection->rows.count; ++i) {
+        if (projection->rows.items[i] >= table->rows) {
+            fprintf(stderr, "%s: ERROR: row %zu is outside of the table\n", table->file_path, projection->rows.items[i]);
+            ok = false;
+            break;
+        }
+    }
+    for (size_t i = 0; i < projection->cols.count; ++i) {
+        if (projection->cols.items[i] >= table->cols) {
+            fprintf(stderr, "%s: ERROR: column %c is outside of the table\n", table->file_path, (char) ('A' + projection->cols.items[i]));
+            ok = false;
+            break;
+        }
+    }
+    for (size_t i = 0; i < projection->cells.count; ++i) {
+        Cell_Index cell_index = projection->cells.items[i];
+        if (!table_contains(table, cell_index)) {
+            fprintf(stderr, "%s: ERROR: cell %c%zu is outside of the table\n", table->file_path, (char) ('A' + cell_index.col), cell_index.row);
+            ok = false;
+            break;
+        }
+    }
+    return ok;
+}
+
+// All the cells the projection outputs
+void projection_collect_cells(const Projection *projection, const Table *table, Cell_Indices *out)
+{
+    if (projection->cells.count > 0) {
+        for (size_t i = 0; i < projection->cells.count; ++i) {
+            cell_indices_push(out, projection->cells.items[i]);
+        }
+        return;
+    }
+
+    size_t rows_count = projection->rows.count > 0 ? projection->rows.count : table->rows;
+    size_t cols_count = projection->cols.count > 0 ? projection->cols.count : table->cols;
+    for (size_t i = 0; i < rows_count; ++i) {
+        for (size_t j = 0; j < cols_count; ++j) {
+            Cell_Index cell_index = {
+                .row = projection->rows.count > 0 ? projection->rows.items[i] : i,
+                .col = projection->cols.count > 0 ? projection->cols.items[j] : j,
+            };
+            cell_indices_push(out, cell_index);
+        }
+    }
+}
+
+void table_render_projection(Table *table, const Projection *projection, FILE *stream)
+{
+    if (projection->cells.count == 0) {
+        table_render_part(table,
+                          projection->rows.count > 0 ? projection->rows.items : NULL,
+                          projection->rows.count > 0 ? projection->rows.count : table->rows,
+                          projection->cols.count > 0 ? projection->cols.items : NULL,
+                          projection->cols.count > 0 ? projection->cols.count : table->cols,
+                          stream);
+        return;
+    }
+
+    stats_begin();
+    size_t name_width = 0;
+    size_t value_width = 0;
+    for (size_t i = 0; i < projection->cells.count; ++i) {
+        Cell_Index cell_index = projection->cells.items[i];
+        int n = snprintf(NULL, 0, "%c%zu", (char) ('A' + cell_index.col), cell_index.row);
+        assert(n >= 0);
+        if (name_width < (size_t) n) {
+            name_width = (size_t) n;
+        }
+        size_t width = cell_width(table, table_cell_at(table, cell_index));
+        if (value_width < width) {
+            value_width = width;
+        }
+    }
+    stats_end(PHASE_WIDTHS);
+
+    stats_begin();
+    for (size_t i = 0; i < projection->cells.count; ++i) {
+        Cell_Index cell_index = projection->cells.items[i];
+        int n = fprintf(stream, "%c%zu", (char) ('A' + cell_index.col), cell_index.row);
+        fprintf(stream, "%*s|", (int) (name_width - n), "");
+        n = fprint_cell(stream, table, table_cell_at(table, cell_index));
+        fprintf(stream, "%*s\n", (int) (value_width - n), "");
+    }
+    stats_end(PHASE_RENDER);
+}
+
+// Scenario sweeps
+//
+// `--sweep <scenarios.csv>` evaluates the table once for every scenario
+// in the file. Its first row lists the input cells, every other row is a
+// scenario with a number for each of them:
+//
+//     A1|C3
+//     100|0.5
+//     200|0.5
+//
+// The table is parsed and analyzed only once, and the cells that don't
+// depend on the inputs are evaluated only once. The varying cells, the
+// inputs and everything downstream of them, hold a vector of values with
+// a lane per scenario. Their expressions are evaluated for SWEEP_LANES
+// scenarios at a time, every operation in a single loop over the lanes.
+
+#define SWEEP_LANES 64
+
+typedef struct {
+    const char *file_path;
+    Cell_Indices inputs;
+    // inputs.count values per scenario
+    double *values;
+    // The line of every scenario
+    size_t *file_rows;
+    size_t count;
+    size_t capacity;
+} Scenarios;
+
+void scenarios_free(Scenarios *scenarios)
+{
+    free(scenarios->inputs.items);
+    free(scenarios->values);
+    free(scenarios->file_rows);
+}
+
+bool scenarios_parse(Scenarios *scenarios, String_View content, Tmp_Cstr *tc)
+{
+    String_View line = sv_chop_by_delim(&content, '\n');
+    const char *line_start = line.data;
+    while (line.count > 0) {
+        String_View field = sv_trim(sv_chop_by_delim(&line, '|'));
+        size_t file_col = field.data - line_start + 1;
+        Cell_Index input = {0};
+        if (!parse_cell_index(field, tc, &input)) {
+            fprintf(stderr, "%s:1:%zu: ERROR: `"SV_Fmt"` is not a cell\n", scenarios->file_path, file_col, SV_Arg(field));
+            return false;
+        }
+        for (size_t i = 0; i < scenarios->inputs.count; ++i) {
+            if (scenarios->inputs.items[i].row == input.row && scenarios->inputs.items[i].col == input.col) {
+                fprintf(stderr, "%s:1:%zu: ERROR: cell "SV_Fmt" is listed twice\n", scenarios->file_path, file_col, SV_Arg(field));
+                return false;
+            }
+        }
+        cell_indices_push(&scenarios->inputs, input);
+    }
+    if (scenarios->inputs.count == 0) {
+        fprintf(stderr, "%s:1:1: ERROR: expected a row of input cells\n", scenarios->file_path);
+        return false;
+    }
+
+    for (size_t file_row = 2; content.count > 0; ++file_row) {
+        line = sv_chop_by_delim(&content, '\n');
+        line_start = line.data;
+        if (sv_trim(line).count == 0) {
+            continue;
+        }
+
+        if (scenarios->count >= scenarios->capacity) {
+            scenarios->capacity = scenarios->capacity == 0 ? 64 : scenarios->capacity * 2;
+            scenarios->values = realloc(scenarios->values, sizeof(*scenarios->values) * scenarios->inputs.count * scenarios->capacity);
+            scenarios->file_rows = realloc(scenarios->file_rows, sizeof(*scenarios->file_rows) * scenarios->capacity);
+        }
+        double *values = &scenarios->values[scenarios->count * scenarios->inputs.count];
+        scenarios->file_rows[scenarios->count] = file_row;
+
+        for (size_t i = 0; i < scenarios->inputs.count; ++i) {
+            if (line.count == 0) {
+                fprintf(stderr, "%s:%zu:%zu: ERROR: expected %zu value%s, but got %zu\n",
+                        scenarios->file_path, file_row, (size_t) (line.data - line_start + 1),
+                        scenarios->inputs.count, scenarios->inputs.count == 1 ? "" : "s", i);
+                return false;
+            }
+            String_View field = sv_trim(sv_chop_by_delim(&line, '|'));
+            if (!sv_strtod(field, tc, &values[i])) {
+                fprintf(stderr, "%s:%zu:%zu: ERROR: `"SV_Fmt"` is not a number\n",
+                        scenarios->file_path, file_row, (size_t) (field.data - line_start + 1), SV_Arg(field));
+                return false;
+            }
+        }
+        if (sv_trim(line).count > 0) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: expected %zu value%s, but got more\n",
+                    scenarios->file_path, file_row, (size_t) (line.data - line_start + 1),
+                    scenarios->inputs.count, scenarios->inputs.count == 1 ? "" : "s");
+            return false;
+        }
+
+        scenarios->count += 1;
+    }
+    if (scenarios->count == 0) {
+        fprintf(stderr, "%s: ERROR: no scenarios\n", scenarios->file_path);
+        return false;
+    }
+
+    return true;
+}
+
+bool scenarios_check(const Scenarios *scenarios, const Table *table)
+{
+    for (size_t i = 0; i < scenarios->inputs.count; ++i) {
+        Cell_Index cell_index = scenarios->inputs.items[i];
+        if (!table_contains(table, cell_index)) {
+            fprintf(stderr, "%s:1: ERROR: cell %c%zu is outside of the table %s\n",
+                    scenarios->file_path, (char) ('A' + cell_index.col), cell_index.row, table->file_path);
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const Scenarios *scenarios;
+    // The varying cells in the evaluation order, the inputs first
+    size_t *varying;
+    size_t varying_count;
+    // The number cells cloned from the inputs. They share the lanes of
+    // their input.
+    size_t *copies;
+    size_t copies_count;
+    // The slot in `varying` of the cell plus one, zero for the cells that
+    // don't vary
+    size_t *slots;
+    // SWEEP_LANES values for every varying cell
+    double *lanes;
+    // The first scenario of the batch being evaluated
+    size_t first;
+    // The explicit stack of sweep_eval_expr(): SWEEP_LANES values for
+    // every operand waiting for its operation
+    Expr_Walk walk;
+    double *operands;
+    size_t operands_count;
+    size_t operands_capacity;
+} Sweep;
+
+void sweep_free(Sweep *sweep)
+{
+    free(sweep->varying);
+    free(sweep->copies);
+    free(sweep->slots);
+    free(sweep->lanes);
+    expr_walk_free(&sweep->walk);
+    free(sweep->operands);
+}
+
+// Finds the number cells that got their value by cloning an input,
+// directly or through other clones
+void sweep_find_copies(Sweep *sweep, Table *table)
+{
+    size_t n = table->rows * table->cols;
+    bool *visited = calloc(n, sizeof(*visited));
+    sweep->copies = malloc(sizeof(*sweep->copies) * n);
+    Cell_Indices path = {0};
+
+    for (size_t i = 0; i < n; ++i) {
+        if (visited[i] || !table->cells[i].cloned || table->cells[i].kind != CELL_KIND_NUMBER) {
+            continue;
+        }
+
+        // Walk the chain until a cell that is not a clone or was seen
+        // already. A cell seen on this very walk is a clone cycle and
+        // doesn't have a slot yet.
+        path.count = 0;
+        Cell_Index index = {
+            .row = i / table->cols,
+            .col = i % table->cols,
+        };
+        size_t slot = 0;
+        for (;;) {
+            size_t offset = table_cell_offset(table, index);
+            if (visited[offset] || !table->cells[offset].cloned) {
+                slot = sweep->slots[offset];
+                break;
+            }
+            visited[offset] = true;
+            cell_indices_push(&path, index);
+
+            index = nbor_in_dir(index, table->cells[offset].clone_dir);
+            if (!table_contains(table, index)) {
+                break;
+            }
+        }
+
+        for (size_t k = 0; slot > 0 && k < path.count; ++k) {
+            size_t offset = table_cell_offset(table, path.items[k]);
+            sweep->slots[offset] = slot;
+            sweep->copies[sweep->copies_count++] = offset;
+        }
+    }
+
+    free(path.items);
+    free(visited);
+}
+
+// Analyzes the table and evaluates everything that doesn't depend on the
+// inputs of the scenarios
+void sweep_prepare(Sweep *sweep, Table *table, Expr_Buffer *eb, const Scenarios *scenarios)
+{
+    size_t n = table->rows * table->cols;
+    sweep->scenarios = scenarios;
+    sweep->slots = calloc(n, sizeof(*sweep->slots));
+    sweep->varying = malloc(sizeof(*sweep->varying) * n);
+
+    // The inputs become plain numbers before the clones are resolved, so
+    // the clones of an input are copies of a number
+    for (size_t i = 0; i < scenarios->inputs.count; ++i) {
+        size_t offset = table_cell_offset(table, scenarios->inputs.items[i]);
+        Cell *cell = &table->cells[offset];
+        cell->kind = CELL_KIND_NUMBER;
+        cell->value = value_number(0.0);
+        cell->cloned = false;
+        sweep->varying[sweep->varying_count++] = offset;
+        sweep->slots[offset] = sweep->varying_count;
+    }
+
+    table_resolve_clones(table);
+    sweep_find_copies(sweep, table);
+
+    Dep_Graph graph = {0};
+    table_build_graph(table, eb, &graph);
+    size_t *order = malloc(sizeof(*order) * graph.count);
+    table_analyze_dependencies(table, &graph, order);
+
+    // Every cell comes after its precedents in the order, so whether they
+    // vary is already known. The cycles are already evaluated to #CYCLE!
+    // whatever the inputs are.
+    for (size_t i = 0; i < n; ++i) {
+        size_t offset = order[i];
+        Cell *cell = &table->cells[offset];
+        if (sweep->slots[offset] > 0 || cell->kind != CELL_KIND_EXPR || cell->status == EVALUATED) {
+            continue;
+        }
+        for (size_t e = graph.edges_start[offset]; e < graph.edges_start[offset + 1]; ++e) {
+            if (sweep->slots[graph.edges[e]] > 0) {
+                sweep->varying[sweep->varying_count++] = offset;
+                sweep->slots[offset] = sweep->varying_count;
+                break;
+            }
+        }
+    }
+
+    // The cells that don't vary never reference the ones that do
+    expr_buffer_begin_pass(eb);
+    for (size_t i = 0; i < n; ++i) {
+        if (sweep->slots[order[i]] == 0) {
+            Cell_Index cell_index = {
+                .row = order[i] / table->cols,
+                .col = order[i] % table->cols,
+            };
+            table_eval_cell(table, eb, cell_index);
+        }
+    }
+
+    sweep->lanes = malloc(sizeof(*sweep->lanes) * SWEEP_LANES * sweep->varying_count);
+
+    free(order);
+    dep_graph_free(&graph);
+}
+
+// Evaluates an expression without operands into `out`
+void sweep_eval_leaf(Table *table, Sweep *sweep, const Expr *expr, const Clone_Site *clone, double *out, size_t lanes)
+{
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        for (size_t k = 0; k < lanes; ++k) {
+            out[k] = expr->as.number;
+        }
+        break;
+
+    // The other sheets don't depend on the inputs
+    case EXPR_KIND_SHEET_CELL: {
+        double number = workbook_eval_cell(expr, clone, sweep->first == 0);
+        for (size_t k = 0; k < lanes; ++k) {
+            out[k] = number;
+        }
+    }
+    break;
+
+    case EXPR_KIND_CELL: {
+        double number = 0.0;
+        Cell_Index cell_index = clone_move(clone, expr->as.cell);
+        if (!table_contains(table, cell_index)) {
+            if (sweep->first == 0) {
+                fprintf(stderr, "%s:%zu:%zu: ERROR: cell reference outside of the table\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+            }
+            number = error_number(ERROR_REF);
+        } else {
+            size_t offset = table_cell_offset(table, cell_index);
+            size_t slot = sweep->slots[offset];
+            if (slot > 0) {
+                memcpy(out, &sweep->lanes[(slot - 1) * SWEEP_LANES], sizeof(*out) * lanes);
+                break;
+            }
+
+            const Cell *target_cell = &table->cells[offset];
+            Value value = cell_value(target_cell);
+            switch (value_type(value)) {
+            case VALUE_NUMBER:
+            case VALUE_ERROR:
+                number = value.number;
+                break;
+            case VALUE_TEXT:
+            case VALUE_EMPTY:
+                if (sweep->first == 0) {
+                    fprintf(stderr, "%s:%zu:%zu: ERROR: text cells may not participate in math expressions\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+                    fprintf(stderr, "%s:%zu:%zu: NOTE: the text cell is located here\n",
+                            table->file_path, cell_index.row + 1, target_cell->file_col);
+                }
+                number = error_number(ERROR_VALUE);
+                break;
+            default:
+                UNREACHABLE("unknown Value Type");
+            }
+        }
+
+        for (size_t k = 0; k < lanes; ++k) {
+            out[k] = number;
+        }
+    }
+    break;
+
+    case EXPR_KIND_BOP:
+    case EXPR_KIND_UOP:
+    default:
+        UNREACHABLE("not a leaf Expression Kind");
+    }
+}
+
+// Applies the binary operator to the lanes of the operands, the result
+// replaces `lhs`
+void sweep_eval_bop(Sweep *sweep, const Expr *expr, const Clone_Site *clone, double *lhs, const double *rhs, size_t lanes)
+{
+    switch (expr->as.bop.kind) {
+    case BOP_KIND_PLUS:
+        for (size_t k = 0; k < lanes; ++k) {
+            lhs[k] = bop_propagate_error(lhs[k] + rhs[k], lhs[k], rhs[k]);
+        }
+        break;
+    case BOP_KIND_MINUS:
+        for (size_t k = 0; k < lanes; ++k) {
+            lhs[k] = bop_propagate_error(lhs[k] - rhs[k], lhs[k], rhs[k]);
+        }
+        break;
+    case BOP_KIND_MULT:
+        for (size_t k = 0; k < lanes; ++k) {
+            lhs[k] = bop_propagate_error(lhs[k] * rhs[k], lhs[k], rhs[k]);
+        }
+        break;
+    case BOP_KIND_DIV: {
+        size_t div0 = lanes;
+        for (size_t k = 0; k < lanes; ++k) {
+            double result = 0.0;
+            if (rhs[k] == 0.0) {
+                if (div0 == lanes && !number_is_error(lhs[k])) {
+                    div0 = k;
+                }
+                result = error_number(ERROR_DIV0);
+            } else {
+                result = lhs[k] / rhs[k];
+            }
+            lhs[k] = bop_propagate_error(result, lhs[k], rhs[k]);
+        }
+        if (div0 < lanes) {
+            fprintf(stderr, "%s:%zu:%zu: ERROR: division by zero\n", expr->file_path, expr_file_row(expr, clone), expr_file_col(expr, clone));
+            fprintf(stderr, "%s:%zu: NOTE: in the scenario on this line\n",
+                    sweep->scenarios->file_path, sweep->scenarios->file_rows[sweep->first + div0]);
+        }
+    }
+    break;
+    case COUNT_BOP_KINDS:
+    default:
+        UNREACHABLE("unknown Binary Operator Kind");
+    }
+}
+
+// Reserves the lanes of one more operand on the stack of the sweep
+double *sweep_push_operand(Sweep *sweep)
+{
+    if (sweep->operands_count >= sweep->operands_capacity) {
+        sweep->operands_capacity = sweep->operands_capacity == 0 ? 16 : sweep->operands_capacity * 2;
+        sweep->operands = realloc(sweep->operands, sizeof(*sweep->operands) * SWEEP_LANES * sweep->operands_capacity);
+    }
+    return &sweep->operands[SWEEP_LANES * sweep->operands_count++];
+}
+
+// Evaluates the expression for the `lanes` scenarios of the batch into
+// `out`. The diagnostics that don't depend on the scenario are only
+// reported for the first batch. Like expr_fold() it walks the tree in
+// post-order with an explicit stack, so the long chains can't overflow
+// the C stack.
+void sweep_eval_expr(Table *table, Expr_Buffer *eb, Sweep *sweep, Expr_Index expr_index, const Clone_Site *clone, double *out, size_t lanes)
+{
+    Expr_Walk *walk = &sweep->walk;
+    walk->count = 0;
+    sweep->operands_count = 0;
+    expr_walk_push(walk, expr_index, false, 0);
+
+    while (walk->count > 0) {
+        Walk_Frame frame = walk->frames[--walk->count];
+        const Expr *expr = expr_buffer_at(eb, frame.index);
+
+        switch (expr->kind) {
+        case EXPR_KIND_NUMBER:
+        case EXPR_KIND_SHEET_CELL:
+        case EXPR_KIND_CELL:
+            sweep_eval_leaf(table, sweep, expr, clone, sweep_push_operand(sweep), lanes);
+            break;
+
+        case EXPR_KIND_BOP:
+            if (!frame.operands_done) {
+                expr_walk_push(walk, frame.index, true, 0);
+                expr_walk_push(walk, expr->as.bop.rhs, false, 0);
+                expr_walk_push(walk, expr->as.bop.lhs, false, 0);
+            } else {
+                sweep->operands_count -= 1;
+                sweep_eval_bop(sweep, expr, clone,
+                               &sweep->operands[SWEEP_LANES * (sweep->operands_count - 1)],
+                               &sweep->operands[SWEEP_LANES * sweep->operands_count], lanes);
+            }
+            break;
+
+        case EXPR_KIND_UOP:
+            if (!frame.operands_done) {
+                expr_walk_push(walk, frame.index, true, 0);
+                expr_walk_push(walk, expr->as.uop.param, false, 0);
+            } else {
+                double *param = &sweep->operands[SWEEP_LANES * (sweep->operands_count - 1)];
+                switch (expr->as.uop.kind) {
+                case UOP_KIND_MINUS:
+                    for (size_t k = 0; k < lanes; ++k) {
+                        param[k] = -param[k];
+                    }
+                    break;
+                default:
+                    UNREACHABLE("unknown Unary Operator Kind");
+                }
+            }
+            break;
+
+        default:
+            UNREACHABLE("unknown Expression Kind");
+        }
+    }
+
+    assert(sweep->operands_count == 1);
+    memcpy(out, sweep->operands, sizeof(*out) * lanes);
+}
+
+// Evaluates the varying cells for the scenarios first..first + lanes
+void sweep_eval_batch(Sweep *sweep, Table *table, Expr_Buffer *eb, size_t first, size_t lanes)
+{
+    const Scenarios *scenarios = sweep->scenarios;
+    sweep->first = first;
+    for (size_t v = 0; v < sweep->varying_count; ++v) {
+        double *out = &sweep->lanes[v * SWEEP_LANES];
+        if (v < scenarios->inputs.count) {
+            for (size_t k = 0; k < lanes; ++k) {
+                out[k] = scenarios->values[(first + k) * scenarios->inputs.count + v];
+            }
+        } else {
+            size_t offset = sweep->varying[v];
+            Cell_Index cell_index = {
+                .row = offset / table->cols,
+                .col = offset % table->cols,
+            };
+            if (table->cells[offset].cloned) {
+                Clone_Site clone = table_clone_site(table, cell_index);
+                sweep_eval_expr(table, eb, sweep, table->cells[offset].expr, &clone, out, lanes);
+            } else {
+                sweep_eval_expr(table, eb, sweep, table->cells[offset].expr, NULL, out, lanes);
+            }
+        }
+    }
+}
+
+// Puts the values of the lane into the varying cells
+void sweep_select_lane(Sweep *sweep, Table *table, size_t lane)
+{
+    for (size_t v = 0; v < sweep->varying_count; ++v) {
+        Cell *cell = &table->cells[sweep->varying[v]];
+        cell->value = value_number(sweep->lanes[v * SWEEP_LANES + lane]);
+        cell->status = EVALUATED;
+    }
+    for (size_t i = 0; i < sweep->copies_count; ++i) {
+        Cell *cell = &table->cells[sweep->copies[i]];
+        cell->value = value_number(sweep->lanes[(sweep->slots[sweep->copies[i]] - 1) * SWEEP_LANES + lane]);
+        cell->status = EVALUATED;
+    }
+}
+
+// Renders the table, or its projection if any, once for every scenario
+// separated by empty lines. Returns the amount of the errors in all of
+// them.
+size_t sweep_run(Sweep *sweep, Table *table, Expr_Buffer *eb, const Projection *projection, const Cell_Indices *projected_cells, FILE *stream)
+{
+    const Scenarios *scenarios = sweep->scenarios;
+    size_t errors = 0;
+    for (size_t first = 0; first < scenarios->count; first += SWEEP_LANES) {
+        size_t lanes = scenarios->count - first < SWEEP_LANES ? scenarios->count - first : SWEEP_LANES;
+
+        stats_begin();
+        sweep_eval_batch(sweep, table, eb, first, lanes);
+        stats_end(PHASE_EVAL);
+
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            sweep_select_lane(sweep, table, lane);
+            if (first + lane > 0) {
+                fprintf(stream, "\n");
+            }
+            if (projection) {
+                table_render_projection(table, projection, stream);
+            } else {
+                table_render(table, stream);
+            }
+            fflush(stream);
+
+            size_t scenario_errors = table_report_errors(table, projected_cells, stderr);
+            if (scenario_errors > 0) {
+                fprintf(stderr, "%s:%zu: NOTE: in the scenario on this line\n", scenarios->file_path, scenarios->file_rows[first + lane]);
+            }
+            errors += scenario_errors;
+        }
+    }
+    return errors;
+}
+
+char *shift_args(int *argc, char ***argv)
+{
+    assert(*argc > 0);
+    char *result = **argv;
+    *argc -= 1;
+    *argv += 1;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    shift_args(&argc, &argv);
+
+    const char *input_file_path = NULL;
+    const char *cache_path = NULL;
+    bool hashcons = false;
+    bool fast_math = false;
+    bool reassociate = false;
+    bool stats_json = false;
+    size_t profile_top = 0;
+    const char *trace_path = NULL;
+    Projection projection = {0};
+    size_t head = 0;
+    const char *sweep_path = NULL;
+    bool parse_only = false;
+    Tmp_Cstr tc = {0};
+
+    while (argc > 0) {
+        const char *flag = shift_args(&argc, &argv);
+
+        if (strcmp(flag, "--serve") == 0 || strcmp(flag, "--watch") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            const char *arg = shift_args(&argc, &argv);
+            return strcmp(flag, "--serve") == 0 ? serve(arg) : watch(arg);
+        } else if (strcmp(flag, "--profile") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            const char *arg = shift_args(&argc, &argv);
+            char *endptr = NULL;
+            profile_top = strtoul(arg, &endptr, 10);
+            if (*arg == '\0' || *endptr != '\0' || profile_top == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects a positive amount of cells, but got %s\n", flag, arg);
+                exit(1);
+            }
+        } else if (strcmp(flag, "--head") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            const char *arg = shift_args(&argc, &argv);
+            char *endptr = NULL;
+            head = strtoul(arg, &endptr, 10);
+            if (*arg == '\0' || *endptr != '\0' || head == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects a positive amount of rows, but got %s\n", flag, arg);
+                exit(1);
+            }
+        } else if (strcmp(flag, "--trace") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            trace_path = shift_args(&argc, &argv);
+        } else if (strcmp(flag, "--sweep") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            sweep_path = shift_args(&argc, &argv);
+        } else if (strcmp(flag, "--rows") == 0 || strcmp(flag, "--columns") == 0 || strcmp(flag, "--cells") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            String_View arg = sv_from_cstr(shift_args(&argc, &argv));
+            bool ok = false;
+            if (strcmp(flag, "--rows") == 0) {
+                ok = parse_axis(arg, false, &tc, &projection.rows);
+            } else if (strcmp(flag, "--columns") == 0) {
+                ok = parse_axis(arg, true, &tc, &projection.cols);
+            } else {
+                ok = parse_cell_list(arg, &tc, &projection.cells);
+            }
+            if (!ok) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: invalid %s `"SV_Fmt"`\n", flag, SV_Arg(arg));
+                exit(1);
+            }
+        } else if (strcmp(flag, "--stats") == 0) {
+            stats.enabled = true;
+        } else if (strcmp(flag, "--stats-json") == 0) {
+            stats.enabled = true;
+            stats_json = true;
+        } else if (strcmp(flag, "--fast-math") == 0) {
+            fast_math = true;
+        } else if (strcmp(flag, "--reassociate") == 0) {
+            reassociate = true;
+        } else if (strcmp(flag, "--hashcons") == 0) {
+            hashcons = true;
+        } else if (strcmp(flag, "--parse-only") == 0) {
+            parse_only = true;
+        } else if (strcmp(flag, "--cache") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no argument is provided for %s\n", flag);
+                exit(1);
+            }
+            cache_path = shift_args(&argc, &argv);
+        } else if (input_file_path == NULL) {
+            input_file_path = flag;
+        } else {
+            usage(stderr);
+            fprintf(stderr, "ERROR: unexpected argument %s\n", flag);
+            exit(1);
+        }
+    }
+
+    if (input_file_path == NULL) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: input file is not provided\n");
+        exit(1);
+    }
+
+    if (projection.cells.count > 0 && (projection.rows.count > 0 || projection.cols.count > 0)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --cells can't be combined with --rows or --columns\n");
+        exit(1);
+    }
+
+    if (head > 0 && (projection.rows.count > 0 || projection.cells.count > 0 || cache_path != NULL)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --head can't be combined with --rows, --cells or --cache\n");
+        exit(1);
+    }
+
+    if (sweep_path != NULL && (head > 0 || cache_path != NULL || profile_top > 0)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --sweep can't be combined with --head, --cache or --profile\n");
+        exit(1);
+    }
+
+    if (parse_only && (head > 0 || cache_path != NULL || profile_top > 0 || sweep_path != NULL || projection_enabled(&projection))) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --parse-only can't be combined with --head, --cache, --profile, --sweep or a projection\n");
+        exit(1);
+    }
+
+    Tracer trace = {0};
+    double sheet_begin_secs = 0.0;
+    if (trace_path != NULL) {
+        tracer = &trace;
+        tracer->origin_secs = clock_wall_secs();
+        sheet_begin_secs = tracer->origin_secs;
+    }
+
+    stats_begin();
+    size_t content_size = 0;
+    char *content = NULL;
+    // Only the beginning of the file is going to be read, don't load the
+    // rest of it
+    bool mapped = false;
+    if (head > 0) {
+        content = file_map(input_file_path, &content_size);
+        mapped = content != NULL;
+    }
+    if (content == NULL) {
+        content = slurp_file(input_file_path, &content_size);
+    }
+    if (content == NULL) {
+        fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                input_file_path, strerror(errno));
+        exit(1);
+    }
+
+    Scenarios scenarios = {
+        .file_path = sweep_path,
+    };
+    if (sweep_path != NULL) {
+        size_t sweep_content_size = 0;
+        char *sweep_content = slurp_file(sweep_path, &sweep_content_size);
+        if (sweep_content == NULL) {
+            fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                    sweep_path, strerror(errno));
+            exit(1);
+        }
+        String_View sweep_input = {
+            .count = sweep_content_size,
+            .data = sweep_content,
+        };
+        if (!scenarios_parse(&scenarios, sweep_input, &tc)) {
+            exit(1);
+        }
+        free(sweep_content);
+    }
+    stats_end(PHASE_READ);
+
+    String_View input = {
+        .count = content_size,
+        .data = content,
+    };
+
+    Expr_Buffer eb = {
+        .hashcons = hashcons,
+    };
+    Table table = {
+        .file_path = input_file_path,
+    };
+    // A partial table of --head and the values per scenario of --sweep
+    // can't be evaluated on demand, the other sheets referring back to the
+    // sheet read their own copy of it then
+    if (head == 0 && sweep_path == NULL) {
+        workbook_add_root(&table, &eb);
+    }
+    size_t root_sheets = workbook.count;
+
+    uint64_t cache_options = 0;
+    if (fast_math) cache_options |= CACHE_OPTION_FAST_MATH;
+    if (reassociate) cache_options |= CACHE_OPTION_REASSOCIATE;
+
+    size_t cell_kinds[CELL_KIND_CLONE + 1] = {0};
+    Profiler profiler = {0};
+    Sweep sweep = {0};
+
+    stats_begin();
+    Cycle_Log cycles = {0};
+    bool cached = cache_path != NULL && cache_load(cache_path, &table, &eb, &cycles, input, cache_options);
+    stats_end(PHASE_CACHE);
+
+    bool projected = head > 0 || projection_enabled(&projection);
+    Cell_Indices projected_cells = {0};
+
+    if (parse_only) {
+        // The cells that don't parse are #PARSE! right away, nothing else
+        // has a value without the evaluation
+        table_parse_content(&table, &eb, &tc, input);
+        table_count_cell_kinds(&table, 0, cell_kinds);
+    } else if (cached) {
+        table_count_cell_kinds(&table, 0, cell_kinds);
+        if (profile_top > 0) {
+            profiler.cells = calloc(table.rows * table.cols, sizeof(*profiler.cells));
+            table.profiler = &profiler;
+        }
+
+        if (projected) {
+            if (!projection_check(&projection, &table)) {
+                exit(1);
+            }
+            projection_collect_cells(&projection, &table, &projected_cells);
+        }
+
+        stats_begin();
+        if (projected) {
+            table_eval_cells(&table, &eb, &projected_cells);
+        } else {
+            // Every cell only depends on the cells before it in the order
+            table_replay_cycles(&table, &cycles);
+            expr_buffer_begin_pass(&eb);
+            for (size_t i = 0; i < table.order.count; ++i) {
+                table_eval_cell(&table, &eb, table.order.items[i]);
+            }
+        }
+        stats_end(PHASE_EVAL);
+    } else {
+        // Only a fully evaluated table can be cached
+        bool write_cache = cache_path != NULL && !projected;
+        Cell_Indices eval_order = {0};
+
+        // With --head only the beginning of the file is parsed. Every time
+        // the first rows turn out to depend on the rows below it, the
+        // parsed part is extended to at least twice as many rows.
+        size_t head_lines = head;
+        for (;;) {
+            bool complete = true;
+            String_View part = head > 0 ? take_lines(input, head_lines, &complete) : input;
+            size_t parsed_rows = table.rows;
+            size_t parsed_cols = table.cols;
+            table_parse_content(&table, &eb, &tc, part);
+            table.partial = !complete;
+            // The new cells only, the old rows could only get empty ones
+            table_count_cell_kinds(&table, parsed_rows, cell_kinds);
+            cell_kinds[CELL_KIND_TEXT] += parsed_rows * (table.cols - parsed_cols);
+
+            stats_begin();
+            table_fold_constants(&table, &eb, parsed_rows, fast_math);
+            if (reassociate) {
+                table_reassociate(&table, &eb, parsed_rows);
+            }
+            stats_end(PHASE_OPTIMIZE);
+
+            if (head > 0) {
+                projection.rows.count = 0;
+                for (size_t row = 0; row < head && row < table.rows; ++row) {
+                    axis_push(&projection.rows, row);
+                }
+            }
+            if (projected) {
+                if (!projection_check(&projection, &table)) {
+                    exit(1);
+                }
+                projected_cells.count = 0;
+                projection_collect_cells(&projection, &table, &projected_cells);
+            }
+
+            if (write_cache) {
+                table.eval_order = &eval_order;
+                table.cycles = &cycles;
+            }
+            if (profile_top > 0) {
+                free(profiler.cells);
+                profiler.cells = calloc(table.rows * table.cols, sizeof(*profiler.cells));
+                table.profiler = &profiler;
+            }
+            stats_begin();
+            bool evaluated = true;
+            if (sweep_path != NULL) {
+                if (!scenarios_check(&scenarios, &table)) {
+                    exit(1);
+                }
+                sweep_prepare(&sweep, &table, &eb, &scenarios);
+            } else if (projected) {
+                evaluated = table_eval_cells(&table, &eb, &projected_cells);
+            } else {
+                table_eval_all(&table, &eb);
+            }
+            stats_end(PHASE_EVAL);
+            if (evaluated) {
+                break;
+            }
+
+            head_lines = head_lines * 2 > table.rows_needed ? head_lines * 2 : table.rows_needed;
+        }
+
+        // The cache could not tell when the other sheets change
+        if (write_cache && workbook.count > root_sheets) {
+            fprintf(stderr, "%s: NOTE: the sheet refers to other sheets, it is not cached\n", input_file_path);
+        } else if (write_cache) {
+            stats_begin();
+            cache_write(cache_path, &table, &eb, &eval_order, &cycles, input, cache_options);
+            stats_end(PHASE_CACHE);
+        }
+        table.eval_order = NULL;
+        table.cycles = NULL;
+        free(eval_order.items);
+    }
+
+    size_t errors = 0;
+    if (sweep_path != NULL) {
+        errors = sweep_run(&sweep, &table, &eb,
+                           projected ? &projection : NULL,
+                           projected ? &projected_cells : NULL,
+                           stdout);
+    } else if (parse_only) {
+        errors = table_report_errors(&table, NULL, stderr);
+    } else {
+        if (projected) {
+            table_render_projection(&table, &projection, stdout);
+        } else {
+            table_render(&table, stdout);
+        }
+        fflush(stdout);
+        errors = table_report_errors(&table, projected ? &projected_cells : NULL, stderr);
+    }
+
+    if (tracer) {
+        fflush(stdout);
+        trace_span("sheet", input_file_path, sheet_begin_secs, clock_wall_secs());
+        bool ok = trace_write(trace_path);
+        free(trace.items);
+        tracer = NULL;
+        if (!ok) {
+            exit(1);
+        }
+    }
+
+    if (stats.enabled) {
+        fflush(stdout);
+        stats_report(stderr, stats_json, cell_kinds, &table, &eb);
+    }
+
+    if (table.profiler) {
+        fflush(stdout);
+        profiler_report(stderr, &table, &eb, profile_top);
+        table.profiler = NULL;
+        free(profiler.cells);
+        free(profiler.frames);
+    }
+
+    if (mapped) {
+        file_unmap(content, content_size);
+    } else {
+        free(content);
+    }
+    table_free(&table);
+    expr_buffer_free(&eb);
+    workbook_free();
+    free(tc.cstr);
+    projection_free(&projection);
+    free(projected_cells.items);
+    free(cycles.items);
+    scenarios_free(&scenarios);
+    sweep_free(&sweep);
+
+    return errors > 0 ? 1 : 0;
+}